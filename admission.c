@@ -0,0 +1,142 @@
+/* Global and per-entry limits on the number of running commands. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "admission.h"
+#include "entry.h"
+#include "globals.h"
+#include "stats.h"
+
+typedef struct waiter {
+    entry_t *entry;
+    admit_t kind;
+    int admitted;
+    pthread_cond_t cond;
+    struct waiter *next;
+} waiter_t;
+
+/* Protects everything below as well as the running count of every entry. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Queue of opens waiting for a slot, in arrival order. */
+static waiter_t *head = NULL;
+static waiter_t *tail = NULL;
+static size_t queued[ADMIT_BACKGROUND + 1];
+
+static size_t running = 0;
+
+static int has_room(entry_t *e) {
+    return (max_children == 0 || running < max_children) &&
+           (e->max_concurrent == 0 || e->running < e->max_concurrent);
+}
+
+static void take_slot(entry_t *e) {
+    ++running;
+    ++e->running;
+    STATS_INC(children_running);
+    STATS_INC(opens_admitted);
+}
+
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* How many callers of a kind may wait at once. */
+static size_t queue_limit(admit_t kind) {
+    switch (kind) {
+        case ADMIT_OPEN:
+            return max_queue;
+        case ADMIT_INTERNAL:
+            return max_waiting;
+        default:
+            return SIZE_MAX;
+    }
+}
+
+int admission_enter(entry_t *e, admit_t kind, int nonblock) {
+    pthread_mutex_lock(&lock);
+
+    /* Every time a slot is freed the queue is rescanned, so no waiter ever
+     * has room. If we have room then, nobody queued could have used this
+     * slot and taking it directly preserves FIFO order.
+     */
+    if (has_room(e)) {
+        take_slot(e);
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    if (nonblock || queued[kind] >= queue_limit(kind)) {
+        pthread_mutex_unlock(&lock);
+        STATS_INC(opens_rejected);
+        return -EAGAIN;
+    }
+
+    waiter_t w = {
+        .entry = e,
+        .kind = kind,
+        .admitted = 0,
+        .next = NULL,
+    };
+    pthread_cond_init(&w.cond, NULL);
+    if (tail == NULL) {
+        head = tail = &w;
+    } else {
+        tail->next = &w;
+        tail = &w;
+    }
+    ++queued[kind];
+    STATS_INC(opens_queued);
+    STATS_INC(opens_waiting);
+
+    unsigned long long start = now_us();
+    while (!w.admitted) {
+        pthread_cond_wait(&w.cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_cond_destroy(&w.cond);
+
+    unsigned long long waited = now_us() - start;
+    STATS_DEC(opens_waiting);
+    STATS_ADD(queue_wait_us_total, waited);
+    STATS_MAX(queue_wait_us_max, waited);
+    return 0;
+}
+
+void admission_leave(entry_t *e) {
+    pthread_mutex_lock(&lock);
+    --running;
+    --e->running;
+    STATS_DEC(children_running);
+
+    /* Admit waiters in arrival order, skipping those whose entry is still at
+     * its own limit.
+     */
+    waiter_t *prev = NULL, *w = head;
+    while (w != NULL && (max_children == 0 || running < max_children)) {
+        waiter_t *next = w->next;
+        if (has_room(w->entry)) {
+            if (prev == NULL) {
+                head = next;
+            } else {
+                prev->next = next;
+            }
+            if (tail == w) {
+                tail = prev;
+            }
+            --queued[w->kind];
+            take_slot(w->entry);
+            w->admitted = 1;
+            pthread_cond_signal(&w->cond);
+        } else {
+            prev = w;
+        }
+        w = next;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,34 @@
+#ifndef _EXECFS_ADMISSION_H_
+#define _EXECFS_ADMISSION_H_
+
+#include "entry.h"
+
+/* Who is asking for a slot. Each kind that waits on a FUSE thread has its own
+ * limit on how many may wait at once, so that neither can take all of FUSE's
+ * threads from the other.
+ */
+typedef enum {
+    /* An open of the entry, limited by --max-queue. */
+    ADMIT_OPEN,
+    /* A run made on a FUSE thread on an open's or read's behalf, such as a
+     * range block, an input or a server request, limited by max_waiting.
+     */
+    ADMIT_INTERNAL,
+    /* A run on one of execfs's own threads, such as a refresh. These hold no
+     * FUSE thread so are never refused.
+     */
+    ADMIT_BACKGROUND,
+} admit_t;
+
+/* Admission control for spawning commands. Each command holds a slot from
+ * admission_enter() until the matching admission_leave() once it has exited.
+ * Callers past either the global (--max-children) or per-entry
+ * (max_concurrent) limit wait in a single FIFO queue.
+ *
+ * Returns 0 once admitted or -EAGAIN if the caller would have to wait and
+ * nonblock is set or as many of its kind are already waiting as allowed.
+ */
+int admission_enter(entry_t *e, admit_t kind, int nonblock);
+void admission_leave(entry_t *e);
+
+#endif
@@ -1,7 +1,7 @@
 #ifndef _EXECFS_ASSERT_H_
 #define _EXECFS_ASSERT_H_
 
-#include <log.h>
+#include "logging.h"
 
 /* Many functions in this code are invoked as FUSE callbacks, which results
  * in assertion failures being invisible to the user. To provide meaningful
@@ -0,0 +1,146 @@
+/* Entries served without a command. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "builtin.h"
+#include "entry.h"
+#include "output.h"
+
+/* Read a whole file into memory. Returns NULL on failure with errno set. */
+static char *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t cap = 0;
+    *len = 0;
+    for (;;) {
+        if (*len == cap) {
+            cap = cap == 0 ? 4096 : cap * 2;
+            char *b = (char*)realloc(buf, cap);
+            if (b == NULL) {
+                goto read_file_fail;
+            }
+            buf = b;
+        }
+        ssize_t sz = read(fd, buf + *len, cap - *len);
+        if (sz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto read_file_fail;
+        } else if (sz == 0) {
+            break;
+        }
+        *len += sz;
+    }
+    close(fd);
+    return buf;
+
+read_file_fail:
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+/* Replace each ${NAME} in a template with the value of NAME from the
+ * environment, or nothing if it is unset. Anything else, including a $ not
+ * followed by a complete ${...}, is copied as is.
+ */
+static char *render(const char *template, size_t len, size_t *out_len) {
+    char *out;
+    size_t out_sz;
+    FILE *f = open_memstream(&out, &out_sz);
+    if (f == NULL) {
+        return NULL;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        if (template[i] == '$' && i + 1 < len && template[i + 1] == '{') {
+            const char *end = memchr(template + i + 2, '}', len - i - 2);
+            if (end != NULL) {
+                size_t name_len = end - (template + i + 2);
+                char *name = strndup(template + i + 2, name_len);
+                if (name == NULL) {
+                    fclose(f);
+                    free(out);
+                    return NULL;
+                }
+                const char *value = getenv(name);
+                free(name);
+                if (value != NULL) {
+                    fputs(value, f);
+                }
+                i = end - template + 1;
+                continue;
+            }
+        }
+        fputc(template[i], f);
+        ++i;
+    }
+
+    if (fclose(f) != 0) {
+        free(out);
+        return NULL;
+    }
+    *out_len = out_sz;
+    return out;
+}
+
+output_t *builtin_output(entry_t *e) {
+    if (e->mode == MODE_CONTENT) {
+        /* Content never changes, so every open shares one copy. */
+        output_t *o = __atomic_load_n(&e->current, __ATOMIC_ACQUIRE);
+        if (o == NULL) {
+            char *data = strdup(e->source);
+            if (data == NULL) {
+                return NULL;
+            }
+            output_t *n = output_new(data, strlen(data));
+            if (n == NULL) {
+                free(data);
+                errno = ENOMEM;
+                return NULL;
+            }
+            if (__sync_bool_compare_and_swap(&e->current, NULL, n)) {
+                o = n;
+            } else {
+                /* Someone else got there first. */
+                output_put(n);
+                o = __atomic_load_n(&e->current, __ATOMIC_ACQUIRE);
+            }
+        }
+        output_get(o);
+        return o;
+    }
+
+    size_t len;
+    char *data = read_file(e->source, &len);
+    if (data == NULL) {
+        return NULL;
+    }
+    if (e->mode == MODE_TEMPLATE) {
+        size_t out_len;
+        char *out = render(data, len, &out_len);
+        free(data);
+        if (out == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        data = out;
+        len = out_len;
+    }
+    output_t *o = output_new(data, len);
+    if (o == NULL) {
+        free(data);
+        errno = ENOMEM;
+    }
+    return o;
+}
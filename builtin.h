@@ -0,0 +1,21 @@
+#ifndef _EXECFS_BUILTIN_H_
+#define _EXECFS_BUILTIN_H_
+
+#include "entry.h"
+#include "output.h"
+
+/* Entry kinds served by execfs itself without running a command: a fixed
+ * string (content), the contents of a file (file) and a file with ${NAME}
+ * replaced by the value of the environment variable NAME (template).
+ */
+
+/* Whether an entry is one of the built-in kinds. */
+#define IS_BUILTIN(e) ((e)->mode == MODE_CONTENT || (e)->mode == MODE_FILE || \
+    (e)->mode == MODE_TEMPLATE)
+
+/* Return a reference to the current contents of a built-in entry, or NULL on
+ * failure with errno set. Files and templates are read afresh each time.
+ */
+output_t *builtin_output(entry_t *e);
+
+#endif
@@ -0,0 +1,199 @@
+/* Block-compressed storage for cached command output. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "cbuf.h"
+#include "stats.h"
+
+/* Uncompressed size of each block. Large enough to compress well, small
+ * enough that a read only decompresses a little more than it needs.
+ */
+#define BLOCK_SIZE (64 * 1024)
+
+typedef struct {
+    char *data;
+    size_t len; /* Compressed length. */
+} block_t;
+
+struct cbuf {
+    unsigned long id; /* Unique, so caches can tell buffers apart. */
+
+    block_t *blocks; /* Full, compressed blocks. */
+    size_t blocks_sz;
+    size_t blocks_cap;
+
+    char *tail; /* Trailing partial block, uncompressed. */
+    size_t tail_len;
+
+    size_t len; /* Total uncompressed length. */
+    int finished;
+};
+
+cbuf_t *cbuf_new(void) {
+    static unsigned long next_id = 0;
+
+    cbuf_t *c = (cbuf_t*)calloc(1, sizeof(cbuf_t));
+    if (c != NULL) {
+        c->id = __sync_add_and_fetch(&next_id, 1);
+    }
+    return c;
+}
+
+void cbuf_free(cbuf_t *c) {
+    size_t i;
+    for (i = 0; i < c->blocks_sz; ++i) {
+        free(c->blocks[i].data);
+    }
+    free(c->blocks);
+    free(c->tail);
+    free(c);
+}
+
+/* Compress the tail into a new block. */
+static int seal(cbuf_t *c) {
+    if (c->blocks_sz == c->blocks_cap) {
+        size_t cap = c->blocks_cap == 0 ? 16 : c->blocks_cap * 2;
+        block_t *b = (block_t*)realloc(c->blocks, sizeof(block_t) * cap);
+        if (b == NULL) {
+            return -1;
+        }
+        c->blocks = b;
+        c->blocks_cap = cap;
+    }
+
+    uLongf len = compressBound(c->tail_len);
+    char *z = (char*)malloc(len);
+    if (z == NULL) {
+        return -1;
+    }
+    if (compress((Bytef*)z, &len, (const Bytef*)c->tail, c->tail_len) != Z_OK) {
+        free(z);
+        return -1;
+    }
+    /* Give back the slack compressBound() asked for. */
+    char *shrunk = (char*)realloc(z, len);
+    if (shrunk != NULL) {
+        z = shrunk;
+    }
+
+    c->blocks[c->blocks_sz].data = z;
+    c->blocks[c->blocks_sz].len = len;
+    ++c->blocks_sz;
+    STATS_ADD(compressed_bytes_in, c->tail_len);
+    STATS_ADD(compressed_bytes_out, len);
+    c->tail_len = 0;
+    return 0;
+}
+
+int cbuf_append(cbuf_t *c, const char *data, size_t len) {
+    if (c->finished) {
+        return -1;
+    }
+    while (len > 0) {
+        if (c->tail == NULL) {
+            c->tail = (char*)malloc(BLOCK_SIZE);
+            if (c->tail == NULL) {
+                return -1;
+            }
+        }
+        size_t n = BLOCK_SIZE - c->tail_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(c->tail + c->tail_len, data, n);
+        c->tail_len += n;
+        c->len += n;
+        data += n;
+        len -= n;
+        if (c->tail_len == BLOCK_SIZE && seal(c) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cbuf_finish(cbuf_t *c) {
+    if (c->tail_len > 0 && seal(c) != 0) {
+        return -1;
+    }
+    free(c->tail);
+    c->tail = NULL;
+    c->finished = 1;
+    return 0;
+}
+
+size_t cbuf_len(const cbuf_t *c) {
+    return c->len;
+}
+
+/* Get the uncompressed contents of a sealed block, using the cache. */
+static const char *block(const cbuf_t *c, cbuf_cache_t *cache, size_t index) {
+    if (cache->data != NULL && cache->id == c->id && cache->block == index) {
+        return cache->data;
+    }
+    if (cache->data == NULL) {
+        cache->data = (char*)malloc(BLOCK_SIZE);
+        if (cache->data == NULL) {
+            return NULL;
+        }
+    }
+    uLongf len = BLOCK_SIZE;
+    if (uncompress((Bytef*)cache->data, &len,
+            (const Bytef*)c->blocks[index].data, c->blocks[index].len) != Z_OK) {
+        free(cache->data);
+        cache->data = NULL;
+        return NULL;
+    }
+    cache->id = c->id;
+    cache->block = index;
+    return cache->data;
+}
+
+int cbuf_read(const cbuf_t *c, cbuf_cache_t *cache, char *buf, size_t size,
+        off_t offset) {
+    size_t len = cbuf_len(c);
+    if (offset >= len) {
+        return 0;
+    }
+    if (size > len - offset) {
+        size = len - offset;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        size_t index = (offset + done) / BLOCK_SIZE;
+        size_t within = (offset + done) % BLOCK_SIZE;
+        size_t n = BLOCK_SIZE - within;
+        if (n > size - done) {
+            n = size - done;
+        }
+
+        const char *src;
+        if (index < c->blocks_sz) {
+            src = block(c, cache, index);
+            if (src == NULL) {
+                return -EIO;
+            }
+        } else {
+            /* Still in the uncompressed tail. */
+            src = c->tail;
+        }
+        memcpy(buf + done, src + within, n);
+        done += n;
+    }
+    return done;
+}
+
+void cbuf_cache_init(cbuf_cache_t *cache) {
+    cache->id = 0;
+    cache->block = 0;
+    cache->data = NULL;
+}
+
+void cbuf_cache_free(cbuf_cache_t *cache) {
+    free(cache->data);
+    cache->data = NULL;
+}
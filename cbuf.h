@@ -0,0 +1,48 @@
+#ifndef _EXECFS_CBUF_H_
+#define _EXECFS_CBUF_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A compressed byte buffer. Data is appended in order and stored as
+ * independently compressed blocks so that any range can be read back by
+ * decompressing only the blocks it covers. The final, partial block is held
+ * uncompressed until it fills or the buffer is finished.
+ */
+typedef struct cbuf cbuf_t;
+
+/* The most recently decompressed block, kept by each reader so that a run of
+ * small sequential reads decompresses each block once. Readers must not share
+ * a cache, but may share a finished buffer, and one cache may be used with
+ * several buffers.
+ */
+typedef struct {
+    unsigned long id; /* Identity of the buffer the block came from. */
+    size_t block;     /* Index of the block held in data. */
+    char *data;       /* NULL if nothing is held. */
+} cbuf_cache_t;
+
+cbuf_t *cbuf_new(void);
+void cbuf_free(cbuf_t *c);
+
+/* Append data. Returns non-zero on failure. */
+int cbuf_append(cbuf_t *c, const char *data, size_t len);
+
+/* Compress the trailing partial block. Nothing may be appended afterwards.
+ * Returns non-zero on failure.
+ */
+int cbuf_finish(cbuf_t *c);
+
+/* Total uncompressed length. */
+size_t cbuf_len(const cbuf_t *c);
+
+/* Read up to size bytes at offset. Returns the number of bytes read or a
+ * negative errno value.
+ */
+int cbuf_read(const cbuf_t *c, cbuf_cache_t *cache, char *buf, size_t size,
+    off_t offset);
+
+void cbuf_cache_init(cbuf_cache_t *cache);
+void cbuf_cache_free(cbuf_cache_t *cache);
+
+#endif
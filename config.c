@@ -11,10 +11,15 @@
 #include <dictionary.h>
 #include <iniparser.h>
 
+#include "builtin.h"
 #include "config.h"
 #include "entry.h"
 #include "macros.h"
 
+/* Defaults for range mode: 1MB blocks, up to 16 of them cached per entry. */
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define DEFAULT_RANGE_CACHE 16
+
 #define printf_arg int(*debug_printf)(char *format, ...)
 
 #define DPRINTF(args...) \
@@ -69,6 +74,296 @@ static int get_int(dictionary *d, char *section, char *key, int notfound) {
     return i;
 }
 
+/* Read a non-negative number, which for a size may be suffixed with K, M or
+ * G. Returns notfound if the key is absent and -2 if it is malformed.
+ */
+static long long get_number(dictionary *d, char *section, char *key,
+        long long notfound, int is_size) {
+    char *tmp = get_string(d, section, key);
+    if (tmp == NULL) {
+        return notfound;
+    }
+    char *end;
+    long long v = strtoll(tmp, &end, 10);
+    if (end == tmp || v < 0) {
+        return -2;
+    }
+    if (!is_size) {
+        return *end == '\0' ? v : -2;
+    }
+    switch (*end) {
+        case 'G': case 'g': v *= 1024; /* Fall through. */
+        case 'M': case 'm': v *= 1024; /* Fall through. */
+        case 'K': case 'k': v *= 1024; ++end; break;
+        default: break;
+    }
+    return *end == '\0' ? v : -2;
+}
+
+static long long get_size(dictionary *d, char *section, char *key,
+        long long notfound) {
+    return get_number(d, section, key, notfound, 1);
+}
+
+static long long get_count(dictionary *d, char *section, char *key,
+        long long notfound) {
+    return get_number(d, section, key, notfound, 0);
+}
+
+/* Parse a CPU list of the form "0-3,6" into a CPU set. Returns non-zero on
+ * failure.
+ */
+static int parse_cpus(cpu_set_t *set, const char *list) {
+    CPU_ZERO(set);
+    const char *p = list;
+    do {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0) {
+            return -1;
+        }
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo) {
+                return -1;
+            }
+        }
+        if (hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (; lo <= hi; ++lo) {
+            CPU_SET(lo, set);
+        }
+        p = end;
+    } while (*p++ == ',');
+    return p[-1] == '\0' ? 0 : -1;
+}
+
+/* Parse an I/O scheduling class of the form "idle", "best-effort[:level]" or
+ * "realtime[:level]". Returns non-zero on failure.
+ */
+static int parse_ionice(spawn_attr_t *attr, const char *value) {
+    const char *level = strchr(value, ':');
+    size_t len = level == NULL ? strlen(value) : level - value;
+
+    if (len == strlen("idle") && !strncmp(value, "idle", len)) {
+        attr->ionice_class = IOPRIO_CLASS_IDLE;
+    } else if (len == strlen("best-effort") && !strncmp(value, "best-effort", len)) {
+        attr->ionice_class = IOPRIO_CLASS_BE;
+    } else if (len == strlen("realtime") && !strncmp(value, "realtime", len)) {
+        attr->ionice_class = IOPRIO_CLASS_RT;
+    } else {
+        return -1;
+    }
+
+    attr->ionice_level = 4; /* The kernel's default. */
+    if (level != NULL) {
+        if (attr->ionice_class == IOPRIO_CLASS_IDLE ||
+                sscanf(level + 1, "%d", &attr->ionice_level) != 1 ||
+                attr->ionice_level < 0 || attr->ionice_level > 7) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Parse the settings applied to an entry's command when it is spawned. Returns
+ * non-zero on failure.
+ */
+static int parse_spawn_attr(spawn_attr_t *attr, dictionary *d, char *name,
+        printf_arg) {
+    spawn_attr_init(attr);
+
+    attr->nice = get_int(d, name, "nice", 0);
+    if (attr->nice < -20 || attr->nice > 19) {
+        DPRINTF("Invalid nice entry\n");
+        return -1;
+    }
+
+    char *tmp = get_string(d, name, "ionice");
+    if (tmp != NULL && parse_ionice(attr, tmp) != 0) {
+        DPRINTF("Invalid ionice entry\n");
+        return -1;
+    }
+
+    tmp = get_string(d, name, "cpus");
+    if (tmp != NULL) {
+        if (parse_cpus(&attr->cpus, tmp) != 0) {
+            DPRINTF("Invalid cpus entry\n");
+            return -1;
+        }
+        attr->has_cpus = 1;
+    }
+
+    /* Only the address space limit is a size. The others are counts. */
+    attr->rlimit_cpu = get_count(d, name, "rlimit_cpu", -1);
+    attr->rlimit_as = get_size(d, name, "rlimit_as", -1);
+    attr->rlimit_nofile = get_count(d, name, "rlimit_nofile", -1);
+    if (attr->rlimit_cpu == -2 || attr->rlimit_as == -2 ||
+            attr->rlimit_nofile == -2) {
+        DPRINTF("Invalid rlimit entry\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Copy a string, replacing the escape sequences \n, \t and \\ with the
+ * characters they stand for. Returns NULL if out of memory.
+ */
+static char *unescape(const char *value) {
+    char *copy = (char*)malloc(strlen(value) + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    char *p = copy;
+    for (; *value != '\0'; ++value) {
+        if (*value == '\\' && value[1] != '\0') {
+            ++value;
+            *p++ = *value == 'n' ? '\n' : *value == 't' ? '\t' : *value;
+        } else {
+            *p++ = *value;
+        }
+    }
+    *p = '\0';
+    return copy;
+}
+
+static void free_sinks(entry_t *e) {
+    size_t i;
+    for (i = 0; i < e->sink_paths_sz; ++i) {
+        free(e->sink_paths[i]);
+    }
+    free(e->sink_paths);
+    e->sink_paths = NULL;
+    e->sink_paths_sz = 0;
+}
+
+/* Split a comma-separated list of sink destinations. Returns non-zero on
+ * failure.
+ */
+static int parse_sinks(entry_t *e, char *list, printf_arg) {
+    char *paths = strdup(list);
+    if (paths == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *saveptr;
+    char *path;
+    for (path = strtok_r(paths, ",", &saveptr); path != NULL;
+            path = strtok_r(NULL, ",", &saveptr)) {
+        while (*path == ' ' || *path == '\t') {
+            ++path;
+        }
+        char *end = path + strlen(path);
+        while (end > path && (end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        if (*path != '/') {
+            DPRINTF("Sink %s is not an absolute path\n", path);
+            goto parse_sinks_fail;
+        }
+
+        char **sink_paths = (char**)realloc(e->sink_paths,
+            sizeof(char*) * (e->sink_paths_sz + 1));
+        if (sink_paths == NULL) {
+            errno = ENOMEM;
+            goto parse_sinks_fail;
+        }
+        e->sink_paths = sink_paths;
+        e->sink_paths[e->sink_paths_sz] = strdup(path);
+        if (e->sink_paths[e->sink_paths_sz] == NULL) {
+            errno = ENOMEM;
+            goto parse_sinks_fail;
+        }
+        ++e->sink_paths_sz;
+    }
+    free(paths);
+
+    if (e->sink_paths_sz == 0) {
+        DPRINTF("Empty sinks entry\n");
+        return -1;
+    }
+    return 0;
+
+parse_sinks_fail:
+    free(paths);
+    return -1;
+}
+
+/* Split a comma-separated list of entry names and find the entries they refer
+ * to. Returns non-zero on failure.
+ */
+static int parse_inputs(entry_t *e, entry_t *entries, size_t len, char *list,
+        printf_arg) {
+    char *names = strdup(list);
+    if (names == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *saveptr;
+    char *name;
+    for (name = strtok_r(names, ",", &saveptr); name != NULL;
+            name = strtok_r(NULL, ",", &saveptr)) {
+        /* Trim surrounding whitespace. */
+        while (*name == ' ' || *name == '\t') {
+            ++name;
+        }
+        char *end = name + strlen(name);
+        while (end > name && (end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+
+        size_t i;
+        for (i = 0; i < len; ++i) {
+            if (!strcmp(entries[i].path, name)) {
+                break;
+            }
+        }
+        if (i == len) {
+            DPRINTF("Unknown input %s\n", name);
+            free(names);
+            return -1;
+        }
+        if (entries[i].mode == MODE_RANGE || entries[i].mode == MODE_SINK) {
+            DPRINTF("Entry %s has no output to be an input\n", name);
+            free(names);
+            return -1;
+        }
+
+        entry_t **inputs = (entry_t**)realloc(e->inputs,
+            sizeof(entry_t*) * (e->inputs_sz + 1));
+        if (inputs == NULL) {
+            free(names);
+            errno = ENOMEM;
+            return -1;
+        }
+        e->inputs = inputs;
+        e->inputs[e->inputs_sz++] = &entries[i];
+    }
+    free(names);
+    return 0;
+}
+
+/* Whether following inputs from an entry leads back to target. */
+static int reaches(entry_t *e, entry_t *target, size_t depth) {
+    if (depth == 0) {
+        /* Deeper than there are entries, so there must be a cycle. */
+        return 1;
+    }
+    size_t i;
+    for (i = 0; i < e->inputs_sz; ++i) {
+        if (e->inputs[i] == target || reaches(e->inputs[i], target, depth - 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* Parse a string into a directory entry. An entry is expected to be in the
  * form:
  *
@@ -110,29 +405,178 @@ static int parse_entry(entry_t *e, dictionary *d, char *name, printf_arg) {
     e->g_r = !!(g & R); e->g_w = !!(g & W); e->g_x = !!(g & X);
     e->o_r = !!(o & R); e->o_w = !!(o & W); e->o_x = !!(o & X);
 
+    /* Parse sink destinations, which replace the command. */
+    tmp = get_string(d, name, "sinks");
+    if (tmp != NULL) {
+        if (parse_sinks(e, tmp, debug_printf) != 0) {
+            goto parse_entry_fail;
+        }
+        e->fdatasync = get_int(d, name, "fdatasync", 0);
+        if (e->fdatasync < 0) {
+            DPRINTF("Invalid fdatasync entry\n");
+            goto parse_entry_fail;
+        }
+    }
+
+    int kinds = e->sink_paths != NULL;
+    int mode = e->sink_paths != NULL ? MODE_SINK : MODE_COMMAND;
+
+    /* Parse built-in contents, which are served without a command. */
+    static const struct {
+        char *key;
+        int mode;
+    } builtins[] = {
+        { "content", MODE_CONTENT },
+        { "file", MODE_FILE },
+        { "template", MODE_TEMPLATE },
+    };
+    int i;
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        tmp = get_string(d, name, builtins[i].key);
+        if (tmp == NULL) {
+            continue;
+        }
+        ++kinds;
+        mode = builtins[i].mode;
+        if (mode != MODE_CONTENT && tmp[0] != '/') {
+            DPRINTF("Invalid %s entry: path must be absolute\n",
+                builtins[i].key);
+            goto parse_entry_fail;
+        }
+        free(e->source);
+        e->source = mode == MODE_CONTENT ? unescape(tmp) : strdup(tmp);
+        if (e->source == NULL) {
+            errno = ENOMEM;
+            goto parse_entry_fail;
+        }
+    }
+
     /* Parse command. */
     tmp = get_string(d, name, "command");
-    if (tmp == NULL) {
-        DPRINTF("Missing command entry\n");
+    if (tmp != NULL) {
+        ++kinds;
+        e->command = strdup(tmp);
+        if (e->command == NULL) {
+            errno = ENOMEM;
+            goto parse_entry_fail;
+        }
+    }
+    if (kinds == 0) {
+        DPRINTF("Missing command, sinks, content, file or template entry\n");
+        goto parse_entry_fail;
+    } else if (kinds > 1) {
+        DPRINTF("Entry must have only one of command, sinks, content, file "
+            "and template\n");
         goto parse_entry_fail;
     }
-    e->command = strdup(tmp);
-    if (e->command == NULL) {
-        errno = ENOMEM;
+
+    /* Parse mode. */
+    tmp = get_string(d, name, "mode");
+    if (mode != MODE_COMMAND) {
+        if (tmp != NULL) {
+            DPRINTF("Only commands can have a mode entry\n");
+            goto parse_entry_fail;
+        }
+        e->mode = mode;
+    } else if (tmp == NULL || !strcmp(tmp, "command")) {
+        e->mode = MODE_COMMAND;
+    } else if (!strcmp(tmp, "range")) {
+        e->mode = MODE_RANGE;
+    } else if (!strcmp(tmp, "server")) {
+        e->mode = MODE_SERVER;
+    } else {
+        DPRINTF("Invalid mode entry\n");
         goto parse_entry_fail;
     }
 
     /* Parse size. */
-    e->size = get_int(d, name, "size", UNSPECIFIED_SIZE);
+    e->size = get_size(d, name, "size", UNSPECIFIED_SIZE);
+    if (e->size == -2) {
+        DPRINTF("Invalid size entry\n");
+        goto parse_entry_fail;
+    }
+
+    /* Parse range mode settings. */
+    e->block_size = get_size(d, name, "block_size", DEFAULT_BLOCK_SIZE);
+    e->range_cache = get_int(d, name, "range_cache", DEFAULT_RANGE_CACHE);
+    if (e->block_size <= 0 || e->range_cache <= 0) {
+        DPRINTF("Invalid block_size or range_cache entry\n");
+        goto parse_entry_fail;
+    }
+    if (e->mode == MODE_RANGE && e->size == UNSPECIFIED_SIZE) {
+        DPRINTF("Range mode requires a size entry\n");
+        goto parse_entry_fail;
+    }
 
     /* Parse cacheable. */
     e->cache = get_int(d, name, "cache", 0);
 
+    /* Parse compression of cached output. */
+    e->compress = get_int(d, name, "compress", 0);
+
+    /* Parse asynchronous write settings. */
+    e->async_write = get_int(d, name, "async_write", 0);
+    e->write_buffer = get_int(d, name, "write_buffer", 0);
+    if (e->write_buffer < 0) {
+        DPRINTF("Invalid write_buffer entry\n");
+        goto parse_entry_fail;
+    }
+
+    /* Parse concurrency limit. */
+    e->max_concurrent = get_int(d, name, "max_concurrent", 0);
+    if (e->max_concurrent < 0) {
+        DPRINTF("Invalid max_concurrent entry\n");
+        goto parse_entry_fail;
+    }
+
+    /* Parse serving of stale output. */
+    e->stale_while_revalidate = get_int(d, name, "stale_while_revalidate", 0);
+    if (e->stale_while_revalidate < 0) {
+        DPRINTF("Invalid stale_while_revalidate entry\n");
+        goto parse_entry_fail;
+    }
+
+    /* Parse periodic refresh interval. */
+    e->refresh = get_int(d, name, "refresh", 0);
+    if (e->refresh < 0) {
+        DPRINTF("Invalid refresh entry\n");
+        goto parse_entry_fail;
+    }
+
+    /* Parse scheduling and resource settings. */
+    if (parse_spawn_attr(&e->spawn, d, name, debug_printf) != 0) {
+        goto parse_entry_fail;
+    }
+
+    if (e->command == NULL && (e->stale_while_revalidate > 0 ||
+            e->refresh > 0)) {
+        DPRINTF("Only commands have output to refresh\n");
+        goto parse_entry_fail;
+    }
+
+    if ((e->mode == MODE_RANGE || e->mode == MODE_SERVER) &&
+            (e->stale_while_revalidate > 0 || e->refresh > 0)) {
+        DPRINTF("Range and server mode can't be used with "
+            "stale_while_revalidate or refresh\n");
+        goto parse_entry_fail;
+    }
+
+    if (e->mode == MODE_CONTENT && e->size == UNSPECIFIED_SIZE) {
+        /* The size is known exactly. */
+        e->size = strlen(e->source);
+    }
+
     return 0;
 
 parse_entry_fail:
-    if (e->path != NULL) free(e->path);
-    if (e->command != NULL) free(e->command);
+    /* Leave nothing for parse_config() to free a second time. */
+    free(e->path);
+    e->path = NULL;
+    free(e->command);
+    e->command = NULL;
+    free(e->source);
+    e->source = NULL;
+    free_sinks(e);
     return -1;
 }
 
@@ -173,6 +617,34 @@ entry_t *parse_config(size_t *len, char *filename, printf_arg) {
         }
     }
 
+    /* Inputs can refer to any entry, so resolve them once all are known. */
+    for (i = 0; i < *len; ++i) {
+        char *inputs = get_string(d, entries[i].path, "inputs");
+        if (inputs == NULL) {
+            continue;
+        }
+        if (IS_BUILTIN(&entries[i])) {
+            DPRINTF("Entry %s has no command to give inputs to\n",
+                entries[i].path);
+            goto parse_config_fail;
+        }
+        if (parse_inputs(&entries[i], entries, *len, inputs, debug_printf) != 0) {
+            goto parse_config_fail;
+        }
+        if (entries[i].u_w || entries[i].g_w || entries[i].o_w ||
+                entries[i].mode != MODE_COMMAND) {
+            DPRINTF("Entry %s with inputs must be a read-only command\n",
+                entries[i].path);
+            goto parse_config_fail;
+        }
+    }
+    for (i = 0; i < *len; ++i) {
+        if (reaches(&entries[i], &entries[i], *len)) {
+            DPRINTF("Inputs of %s form a cycle\n", entries[i].path);
+            goto parse_config_fail;
+        }
+    }
+
     return entries;
 
 parse_config_fail:
@@ -182,6 +654,9 @@ parse_config_fail:
         for (i = 0; i < *len; ++i) {
             free(entries[i].path);
             free(entries[i].command);
+            free(entries[i].source);
+            free(entries[i].inputs);
+            free_sinks(&entries[i]);
         }
         free(entries);
     }
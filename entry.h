@@ -1,11 +1,15 @@
 #ifndef _EXECFS_ENTRY_H_
 #define _EXECFS_ENTRY_H_
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "cbuf.h"
+#include "pipes.h"
 
-typedef struct {
+typedef struct entry {
     char *path;
     int u_r : 1;
     int u_w : 1;
@@ -17,18 +21,95 @@ typedef struct {
     int o_w : 1;
     int o_x : 1;
     char *command;
-    int size;
+    char *source; /* Content, or file or template path, of built-in kinds. */
+    int mode;
+    off_t size;
     int cache;
+    int compress;
+    int async_write;
+    int write_buffer;
+    int max_concurrent;
+    spawn_attr_t spawn;
+    int stale_while_revalidate;
+    int refresh;
+    off_t block_size;
+    int range_cache;
+    struct entry **inputs; /* Entries whose output is fed to the command. */
+    size_t inputs_sz;
+    char **sink_paths; /* Files that writes are appended to, for sinks. */
+    size_t sink_paths_sz;
+    int fdatasync;
+    ino_t ino; /* Assigned by lookup_init(). */
+
+    /* Runtime state. */
+    int running; /* Open handles, protected by the admission lock. */
+    struct output *current; /* Latest output, protected by the output lock. */
+    int refreshing;
+    unsigned int refreshes;
+    time_t attempted; /* Monotonic time the last run ended, failed or not. */
+    struct range *range; /* Block cache, protected by the range lock. */
+    struct server *server; /* Worker state, protected by the server lock. */
+    struct sink **sinks; /* Open destinations, protected by the sink lock. */
 } entry_t;
 
 #define UNSPECIFIED_SIZE (-1)
 
+/* How an entry's command is used. */
+#define MODE_COMMAND 0 /* Run once per open. */
+#define MODE_RANGE 1   /* Run once per block read. */
+#define MODE_SERVER 2  /* Run once and sent a request per open. */
+#define MODE_SINK 3    /* No command; writes are appended to files. */
+#define MODE_CONTENT 4 /* No command; a fixed string. */
+#define MODE_FILE 5    /* No command; the contents of a file. */
+#define MODE_TEMPLATE 6 /* No command; a file with variables substituted. */
+
+struct output;
+struct range;
+struct server;
+struct sink;
+struct writer;
+
 typedef struct {
+    uint64_t id; /* Identifies the handle to FUSE, see handles.h. */
+
+    /* FUSE may call read, write and flush on the same handle from several
+     * threads at once. This guards the state those change: the server
+     * request, the cached output (buf, len and zbuf) and zcache. Readers of
+     * output that is already cached share it and everything else that uses
+     * that state holds it exclusively, but never while waiting on a command
+     * (see fill_lock). Reads and writes that go straight to a pipe or
+     * writer, or to an uncompressed output, don't take it.
+     * Release is never concurrent with other operations on the handle.
+     */
+    pthread_rwlock_t lock;
+    /* Held by the one thread filling the cache from the pipe, which only
+     * takes the lock above to grow the cache, so that readers of what is
+     * already cached don't wait on the command. Server mode handles hold it
+     * instead while their request is out.
+     */
+    pthread_mutex_t fill_lock;
     int read_fd;
     int write_fd;
+    struct output *output; /* Complete output to serve, if not reading a pipe. */
+    entry_t *range; /* Range mode entry to serve, if not reading a pipe. */
+    entry_t *sink; /* Sink entry to append writes to, if not writing a pipe. */
+    int positional; /* read_fd is a regular file, read with pread(). */
+
+    /* Server mode request being built from writes, sent on the first read or
+     * flush. Once replied is set, output holds the reply or NULL on failure.
+     */
+    entry_t *server;
+    uid_t uid;
+    char *input;
+    size_t input_len;
+    int sent;
+    int replied;
     char *buf;
     size_t len;
     int cache;
+    cbuf_t *zbuf; /* Replaces buf when the entry's output is compressed. */
+    cbuf_cache_t zcache;
+    struct writer *writer;
 } handle_t;
 
 #endif
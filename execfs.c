@@ -0,0 +1,255 @@
+/* The FUSE-independent front end of the file system. The FUSE operations in
+ * fileops.c are thin wrappers around these.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "assert.h"
+#include "config.h"
+#include "entry.h"
+#include "execfs.h"
+#include "globals.h"
+#include "impl.h"
+#include "logging.h"
+#include "lookup.h"
+#include "macros.h"
+#include "scheduler.h"
+#include "server.h"
+#include "sink.h"
+
+/* Whether this path is the root of the mount point. */
+static int is_root(const char *path) {
+    return !strcmp("/", path);
+}
+
+/* Whether this path is the statistics file, if one was requested. */
+static int is_stats(const char *path) {
+    return stats_path != NULL && path[0] == '/' && !strcmp(path + 1, stats_path);
+}
+
+int execfs_load(char *config_filename, int(*debug_printf)(char *format, ...)) {
+    entries = parse_config(&entries_sz, config_filename, debug_printf);
+    if (entries_sz == PARSE_FAIL) {
+        if (errno != 0) {
+            perror("Failed to parse configuration file");
+        } else {
+            fprintf(stderr, "Failed to parse configuration file\n");
+        }
+        return -1;
+    }
+
+    if (stats_path != NULL) {
+        size_t i;
+        for (i = 0; i < entries_sz; ++i) {
+            if (!strcmp(entries[i].path, stats_path)) {
+                fprintf(stderr, "Statistics file %s conflicts with an entry\n", stats_path);
+                return -1;
+            }
+        }
+    }
+
+    if (lookup_init() != 0) {
+        fprintf(stderr, "Failed to index entries\n");
+        return -1;
+    }
+
+    /* Set the owner of the mount point entries. */
+    uid = geteuid();
+    gid = getegid();
+
+    return 0;
+}
+
+int execfs_start(void) {
+    if (log_start() != 0) {
+        fprintf(stderr, "Failed to start log writer\n");
+    }
+    if (scheduler_start() != 0) {
+        /* Refresh entries fall back to being refreshed when read. */
+        LOG(ERROR, "failed to start refresh scheduler");
+    }
+    return 0;
+}
+
+void execfs_stop(void) {
+    scheduler_stop();
+    server_stop();
+    sink_stop();
+    log_close();
+}
+
+int execfs_exists(const char *path) {
+    return is_root(path) || is_stats(path) || lookup(path) != NULL;
+}
+
+/* Fill in the attributes of the root, the statistics file (if e is NULL) or
+ * an entry. These are shared by getattr and readdir.
+ */
+static void fill_stat(struct stat *stbuf, int root, entry_t *e) {
+    memset(stbuf, 0, sizeof(*stbuf));
+
+    /* stbuf->st_dev is ignored. */
+
+    /* Mark every entry as owned by the mounter. */
+    stbuf->st_uid = uid;
+    stbuf->st_gid = gid;
+
+    /* stbuf-st_rdev is irrelevant. */
+    /* stbuf->st_blksize is ignored. */
+    /* stbuf->st_blocks is ignored. */
+
+    /* The current time is as good as any considering any process reading this
+     * file may encounter different data to last time.
+     */
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
+
+    if (root) {
+        stbuf->st_ino = ROOT_INO;
+        stbuf->st_mode = S_IFDIR|S_IRUSR|S_IXUSR|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH;
+        stbuf->st_size = 0; /* FIXME: This should be set more appropriately. */
+        stbuf->st_nlink = 1;
+    } else if (e == NULL) {
+        stbuf->st_ino = lookup_stats_ino();
+        stbuf->st_mode = S_IFREG|S_IRUSR|S_IRGRP|S_IROTH;
+        stbuf->st_size = size;
+        stbuf->st_nlink = 1;
+    } else {
+        /* It would be nice to mark entries as FIFOs (S_IFIFO), but
+         * irritatingly the kernel doesn't call FUSE handlers for FIFOs so we
+         * never get read/write calls.
+         */
+        stbuf->st_mode = S_IFREG
+            | (e->u_r ? S_IRUSR : 0)
+            | (e->u_w ? S_IWUSR : 0)
+            | (e->u_x ? S_IXUSR : 0)
+            | (e->g_r ? S_IRGRP : 0)
+            | (e->g_w ? S_IWGRP : 0)
+            | (e->g_x ? S_IXGRP : 0)
+            | (e->o_r ? S_IROTH : 0)
+            | (e->o_w ? S_IWOTH : 0)
+            | (e->o_x ? S_IXOTH : 0);
+        stbuf->st_ino = e->ino;
+        stbuf->st_size = e->size == UNSPECIFIED_SIZE ? size : e->size;
+
+        /* A file passed through is as big and as old as the real one. */
+        struct stat real;
+        if (e->mode == MODE_FILE && stat(e->source, &real) == 0) {
+            if (e->size == UNSPECIFIED_SIZE) {
+                stbuf->st_size = real.st_size;
+            }
+            stbuf->st_atime = real.st_atime;
+            stbuf->st_mtime = real.st_mtime;
+            stbuf->st_ctime = real.st_ctime;
+        }
+        stbuf->st_nlink = 1;
+    }
+}
+
+int execfs_getattr(const char *path, struct stat *stbuf) {
+    LOG(DEBUG, "getattr called on %s", path);
+    assert(stbuf != NULL);
+
+    if (is_root(path)) {
+        fill_stat(stbuf, 1, NULL);
+    } else if (is_stats(path)) {
+        fill_stat(stbuf, 0, NULL);
+    } else {
+        entry_t *e = lookup(path);
+        if (e == NULL) {
+            return -ENOENT;
+        }
+        fill_stat(stbuf, 0, e);
+    }
+    return 0;
+}
+
+int execfs_readdir(const char *path, void *buf, execfs_filler_t filler,
+        off_t offset) {
+    LOG(DEBUG, "readdir called on %s", path);
+    if (!is_root(path)) {
+        /* Don't support subdirectories. */
+        return -EBADF;
+    }
+
+    /* Every entry is returned with its full attributes so that listing the
+     * directory doesn't need a separate getattr for each. Offsets are
+     * positions in the listing: ".", "..", the entries and finally the
+     * statistics file.
+     */
+    struct stat st;
+    off_t i;
+    for (i = offset; i < 2; ++i) {
+        fill_stat(&st, 1, NULL);
+        if (filler(buf, i == 0 ? "." : "..", &st, i + 1) != 0) {
+            return 0;
+        }
+    }
+    for (; i < entries_sz + 2; ++i) {
+        entry_t *e = &entries[i - 2];
+        assert(e->path != NULL);
+        fill_stat(&st, 0, e);
+        if (filler(buf, e->path, &st, i + 1) != 0) {
+            return 0;
+        }
+    }
+    if (stats_path != NULL && i == entries_sz + 2) {
+        fill_stat(&st, 0, NULL);
+        (void)filler(buf, stats_path, &st, i + 1);
+    }
+    return 0;
+}
+
+int execfs_open(const char *path, int flags, uid_t user, gid_t group,
+        uint64_t *fh) {
+    assert(fh != NULL);
+    LOG(DEBUG, "open called on %s with flags %d", path, flags);
+    if (is_stats(path)) {
+        if ((flags & RIGHTS_MASK) != O_RDONLY) {
+            return -EACCES;
+        }
+        return file_open_stats(fh);
+    }
+
+    entry_t *e = lookup(path);
+    if (e == NULL) {
+        return -ENOENT;
+    }
+
+    unsigned int entry_rights = access_rights(e, user, group);
+    unsigned int rights = flags & RIGHTS_MASK;
+
+    if (((rights == O_RDONLY || rights == O_RDWR) && !(entry_rights & R)) ||
+        ((rights == O_WRONLY || rights == O_RDWR) && !(entry_rights & W))) {
+        return -EACCES;
+    }
+
+    LOG(DEBUG, "Opening %s (%s) for %s", path,
+        e->command != NULL ? e->command :
+        e->source != NULL ? e->source : "sink",
+        rights == O_RDONLY ? "read" :
+        rights == O_WRONLY ? "write" : "read/write");
+
+    return file_open(e, rights, flags, user, group, fh);
+}
+
+int execfs_read(uint64_t fh, char *buf, size_t size, off_t offset) {
+    return file_read(buf, size, offset, fh);
+}
+
+int execfs_write(uint64_t fh, const char *buf, size_t size, off_t offset) {
+    return file_write(buf, size, offset, fh);
+}
+
+int execfs_flush(uint64_t fh) {
+    return file_flush(fh);
+}
+
+int execfs_release(uint64_t fh) {
+    return file_close(fh);
+}
@@ -0,0 +1,53 @@
+/* The file system behind the FUSE layer, usable on its own. This is the API
+ * of libexecfs: the entry table, the commands run for it, their caches and the
+ * handles of open files, with paths relative to the mount point and open
+ * files identified by handle ID. Nothing here depends on FUSE, so a program
+ * can link against the library and operate on the file system in-process.
+ *
+ * All functions returning int return 0 (or a byte count) on success and a
+ * negated errno on failure, as FUSE operations do.
+ */
+
+#ifndef _EXECFS_EXECFS_H_
+#define _EXECFS_EXECFS_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Read the entries from a configuration file and index them. Entries are
+ * owned by the calling user. Any debug_printf is passed through to the
+ * configuration parser. Problems are reported on stderr. Returns 0 on success.
+ */
+int execfs_load(char *config_filename, int(*debug_printf)(char *format, ...));
+
+/* Start and stop the background threads. Call execfs_start after any fork,
+ * as threads don't survive one, and before operating on files.
+ */
+int execfs_start(void);
+void execfs_stop(void);
+
+/* Whether a path names the root, the statistics file or an entry. */
+int execfs_exists(const char *path);
+
+int execfs_getattr(const char *path, struct stat *stbuf);
+
+/* Called for each directory entry with its attributes and the offset of the
+ * next. Return non-zero to stop. This matches fuse_fill_dir_t.
+ */
+typedef int (*execfs_filler_t)(void *buf, const char *name,
+    const struct stat *stbuf, off_t offset);
+int execfs_readdir(const char *path, void *buf, execfs_filler_t filler,
+    off_t offset);
+
+/* Open a file as the given user with open(2) flags, returning its handle ID
+ * through fh.
+ */
+int execfs_open(const char *path, int flags, uid_t uid, gid_t gid,
+    uint64_t *fh);
+int execfs_read(uint64_t fh, char *buf, size_t size, off_t offset);
+int execfs_write(uint64_t fh, const char *buf, size_t size, off_t offset);
+int execfs_flush(uint64_t fh);
+int execfs_release(uint64_t fh);
+
+#endif
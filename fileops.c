@@ -1,179 +1,113 @@
-/* Implementations of all the FUSE operations for this file system. */
+/* Implementations of all the FUSE operations for this file system. These
+ * translate between FUSE and the library's API in execfs.h.
+ */
 
 #include <errno.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <time.h>
-#include <log.h>
 #include "assert.h"
 #include "entry.h"
+#include "execfs.h"
 #include "fileops.h"
 #include "globals.h"
-#include "impl.h"
-#include "macros.h"
+#include "logging.h"
 
-/* Whether this path is the root of the mount point. */
-static int is_root(const char *path) {
-    return !strcmp("/", path);
-}
+FILE *trace = NULL;
 
-/* Note: doing a linear search on the entries array is not an efficient way of
- * implementing a file system that will be under heavy load, but we assume that
- * there will be few entries in the file system and these will not be accessed
- * frequently.
+/* Record an operation in the trace, if one was requested. A single fprintf
+ * writes a whole line under the stream's lock, so concurrent operations
+ * don't interleave.
  */
-static entry_t *find_entry(const char *path) {
-    if (path[0] != '/') {
-        /* We were passed a path outside this mount point (?) */
-        return NULL;
-    }
+#define TRACE(args...) \
+    do { \
+        if (trace != NULL) { \
+            fprintf(trace, args); \
+        } \
+    } while (0)
+
+/* Called when the file system is mounted. */
+static void *exec_init(struct fuse_conn_info *conn) {
+    /* By now any daemonising fork has happened, so the library's threads can
+     * run.
+     */
+    (void)execfs_start();
+    LOG(INFO, "init called (mounting file system)");
 
+#ifdef FUSE_CAP_BIG_WRITES
+    /* Entries with asynchronous writes benefit from receiving writes in
+     * chunks larger than a page as they are coalesced anyway.
+     */
     int i;
     for (i = 0; i < entries_sz; ++i) {
-        if (!strcmp(path + 1, entries[i].path)) {
-            return &entries[i];
+        if (entries[i].async_write) {
+            conn->want |= FUSE_CAP_BIG_WRITES;
+            break;
         }
     }
-    return NULL;
-}
+#endif
 
-/* Determine the permissions of a given file in the context of the user
- * currently operating on it.
- */
-static unsigned int access_rights(entry_t *entry) {
-    struct fuse_context *context = fuse_get_context();
-    unsigned int rights;
-
-    assert(context != NULL);
-    assert(entry != NULL);
-
-    if (context->uid == uid) {
-        rights = (entry->u_r ? R : 0)
-            | (entry->u_w ? W : 0)
-            | (entry->u_x ? X : 0);
-    } else if (context->gid == gid) {
-        rights = (entry->g_r ? R : 0)
-            | (entry->g_w ? W : 0)
-            | (entry->g_x ? X : 0);
-    } else {
-        rights = (entry->o_r ? R : 0)
-            | (entry->o_w ? W : 0)
-            | (entry->o_x ? X : 0);
-    }
-    return rights;
+    return NULL;
 }
 
 /* Called when the file system is unmounted. */
 static void exec_destroy(void *private_data) {
     LOG(INFO, "destroy called (unmounting file system)");
-    log_close();
+    execfs_stop();
+    if (trace != NULL) {
+        fclose(trace);
+        trace = NULL;
+    }
 }
 
 /* Start of "interesting" code. */
 
-static int exec_getattr(const char *path, struct stat *stbuf) {
-    LOG(DEBUG, "getattr called on %s", path);
-    assert(stbuf != NULL);
-
-    /* stbuf->st_dev is ignored. */
-    /* stbuf->st_ino is ignored. */
-
-    /* Mark every entry as owned by the mounter. */
-    stbuf->st_uid = uid;
-    stbuf->st_gid = gid;
-
-    /* stbuf-st_rdev is irrelevant. */
-    /* stbuf->st_blksize is ignored. */
-    /* stbuf->st_blocks is ignored. */
-
-    /* The current time is as good as any considering any process reading this
-     * file may encounter different data to last time.
-     */
-    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
-
-    if (is_root(path)) {
-        stbuf->st_mode = S_IFDIR|S_IRUSR|S_IXUSR|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH;
-        stbuf->st_size = 0; /* FIXME: This should be set more appropriately. */
-        stbuf->st_nlink = 1;
-    } else {
-        entry_t *e = find_entry(path);
-        if (e == NULL) {
-            return -ENOENT;
-        }
+static int exec_flush(const char *path, struct fuse_file_info *fi) {
+    TRACE("flush %llx\n", (unsigned long long)fi->fh);
+    return execfs_flush(fi->fh);
+}
 
-        /* It would be nice to mark entries as FIFOs (S_IFIFO), but
-         * irritatingly the kernel doesn't call FUSE handlers for FIFOs so we
-         * never get read/write calls.
-         */
-        stbuf->st_mode = S_IFREG
-            | (e->u_r ? S_IRUSR : 0)
-            | (e->u_w ? S_IWUSR : 0)
-            | (e->u_x ? S_IXUSR : 0)
-            | (e->g_r ? S_IRGRP : 0)
-            | (e->g_w ? S_IWGRP : 0)
-            | (e->g_x ? S_IXGRP : 0)
-            | (e->o_r ? S_IROTH : 0)
-            | (e->o_w ? S_IWOTH : 0)
-            | (e->o_x ? S_IXOTH : 0);
-        stbuf->st_size = e->size == UNSPECIFIED_SIZE ? size : e->size;
-        stbuf->st_nlink = 1;
-    }
+static int exec_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    TRACE("flush %llx\n", (unsigned long long)fi->fh);
+    return execfs_flush(fi->fh);
+}
 
-    return 0;
+static int exec_getattr(const char *path, struct stat *stbuf) {
+    TRACE("getattr %s\n", path);
+    return execfs_getattr(path, stbuf);
 }
 
 static int exec_open(const char *path, struct fuse_file_info *fi) {
     assert(fi != NULL);
-    LOG(DEBUG, "open called on %s with flags %d", path, fi->flags);
-    entry_t *e = find_entry(path);
-    if (e == NULL) {
-        return -ENOENT;
-    }
-
-    unsigned int entry_rights = access_rights(e);
-    unsigned int rights = fi->flags & RIGHTS_MASK;
-
-    if (((rights == O_RDONLY || rights == O_RDWR) && !(entry_rights & R)) ||
-        ((rights == O_WRONLY || rights == O_RDWR) && !(entry_rights & W))) {
-        return -EACCES;
+    struct fuse_context *context = fuse_get_context();
+    assert(context != NULL);
+    uint64_t fh;
+    int r = execfs_open(path, fi->flags, context->uid, context->gid, &fh);
+    if (r == 0) {
+        fi->fh = fh;
+        TRACE("open %llx %o %s\n", (unsigned long long)fh, fi->flags, path);
     }
-
-    LOG(DEBUG, "Opening %s (%s) for %s", path, e->command,
-        rights == O_RDONLY ? "read" :
-        rights == O_WRONLY ? "write" : "read/write");
-
-    return file_open(e, rights, fi);
+    return r;
 }
 
 static int exec_read(const char *path, char *buf, size_t size, off_t offset, info_t *fi) {
-    return file_read(buf, size, offset, fi);
+    TRACE("read %llx %zu %lld\n", (unsigned long long)fi->fh, size,
+        (long long)offset);
+    return execfs_read(fi->fh, buf, size, offset);
 }
 
 static int exec_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
-    LOG(DEBUG, "readdir called on %s", path);
-    if (!is_root(path)) {
-        /* Don't support subdirectories. */
-        return -EBADF;
-    }
-
-    int i;
-    for (i = offset; i < entries_sz; ++i) {
-        assert(entries[i].path != NULL);
-        if (filler(buf, entries[i].path, NULL, i + 1) != 0) {
-            return 0;
-        }
-    }
-    return 0;
+    TRACE("readdir %lld %s\n", (long long)offset, path);
+    return execfs_readdir(path, buf, filler, offset);
 }
 
 static int exec_release(const char *path, struct fuse_file_info *fi) {
-    return file_close(fi);
+    TRACE("release %llx\n", (unsigned long long)fi->fh);
+    return execfs_release(fi->fh);
 }
 
 static int exec_write(const char *path, const char *buf, size_t size, off_t offset, info_t *fi) {
-    return file_write(buf, size, offset, fi);
+    TRACE("write %llx %zu %lld\n", (unsigned long long)fi->fh, size,
+        (long long)offset);
+    return execfs_write(fi->fh, buf, size, offset);
 }
 
 /* Stub out all the irrelevant functions. */
@@ -187,7 +121,7 @@ static int exec_write(const char *path, const char *buf, size_t size, off_t offs
     static int exec_ ## func(const char *path , ## args) { \
         assert(path != NULL); \
         LOG(DEBUG, "No-op stubbed function %s called on %s", __func__, path); \
-        if (!is_root(path) && find_entry(path) == NULL) { \
+        if (!execfs_exists(path)) { \
             return -ENOENT; \
         } \
         return 0; \
@@ -195,8 +129,6 @@ static int exec_write(const char *path, const char *buf, size_t size, off_t offs
 FAIL_STUB(bmap, size_t blocksize, uint64_t *idx);
 FAIL_STUB(chmod, mode_t mode); /* Edit the config file to change permissions. */
 FAIL_STUB(chown, uid_t uid, gid_t gid);
-NOP_STUB(flush, struct fuse_file_info *fi);
-NOP_STUB(fsync, int datasync, struct fuse_file_info *fi);
 NOP_STUB(fsyncdir, int datasync, struct fuse_file_info *fi);
 FAIL_STUB(link, const char *target);
 FAIL_STUB(mkdir, mode_t mode); /* Subdirectories not supported. */
@@ -231,7 +163,7 @@ struct fuse_operations ops = {
     OP(fsyncdir),
     OP(getattr),
     // TODO getxattr
-    // TODO init
+    OP(init),
     // TODO ioctl
     OP(link),
     // TODO listxattr
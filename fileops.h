@@ -1,10 +1,14 @@
 #ifndef _EXECFS_FILEOPS_H_
 #define _EXECFS_FILEOPS_H_
 
-/* Use newer version of FUSE API. */
-#define FUSE_USE_VERSION 26
-#include <fuse.h>
+#include <stdio.h>
+#include "fuse.h"
 
 extern struct fuse_operations ops;
 
+/* If set, each operation is appended to this file in the trace format read by
+ * tools/replay.
+ */
+extern FILE *trace;
+
 #endif
@@ -0,0 +1,55 @@
+/* Global state and settings shared by the file system and its tools. */
+
+#include <stddef.h>
+#include <unistd.h>
+#include "entry.h"
+#include "globals.h"
+
+/* Entries to present to the user in the mount point. */
+entry_t *entries = NULL;
+size_t entries_sz = 0;
+
+/* Identity of the mounter. This will become the owner of all entries in the
+ * mount point.
+ */
+uid_t uid;
+gid_t gid;
+
+/* Size in bytes to assign to each file. */
+#define DEFAULT_SIZE (10 * 1024) /* 10 KB */
+size_t size = DEFAULT_SIZE;
+
+/* Maximum bytes buffered per handle for entries with asynchronous writes
+ * before writers are blocked.
+ */
+#define DEFAULT_WRITE_BUFFER (1024 * 1024) /* 1 MB */
+size_t write_buffer_size = DEFAULT_WRITE_BUFFER;
+
+/* Size of the pool of threads draining async_write and sink writers. A write
+ * to a command that isn't reading its input holds one of them until it does.
+ */
+#define DEFAULT_WRITER_THREADS 8
+size_t writer_threads = DEFAULT_WRITER_THREADS;
+
+/* Limit on concurrently running commands. Zero means unlimited. */
+size_t max_children = 0;
+
+/* Each open waiting for a command to be admitted occupies one of FUSE's
+ * threads, as does each range block, input or server request run on an
+ * open's behalf. So that the rest are left to serve the reads and releases
+ * that let running commands finish, by default at most this many of each may
+ * wait at once. Single-threaded mounts (-s) can't wait at all.
+ */
+#define DEFAULT_MAX_WAITING 8
+size_t max_queue = DEFAULT_MAX_WAITING;
+size_t max_waiting = DEFAULT_MAX_WAITING;
+
+/* Percentage of an entry's refresh interval by which runs are randomly
+ * offset, and the maximum number of scheduled runs at once (zero for
+ * unlimited).
+ */
+unsigned int refresh_jitter = 10;
+size_t refresh_concurrency = 4;
+
+/* Name of the statistics file to present in the mount point, if any. */
+char *stats_path = NULL;
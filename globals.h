@@ -15,4 +15,16 @@ extern gid_t gid;
 
 extern size_t size;
 
+extern size_t write_buffer_size;
+extern size_t writer_threads;
+
+extern size_t max_children;
+extern size_t max_queue;
+extern size_t max_waiting;
+
+extern char *stats_path;
+
+extern unsigned int refresh_jitter;
+extern size_t refresh_concurrency;
+
 #endif
@@ -0,0 +1,104 @@
+/* Slab allocation of handles. */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "entry.h"
+#include "handles.h"
+
+/* Handles per slab and the most slabs there can be. Together these cap the
+ * number of simultaneously open files at a little over four million.
+ */
+#define SLAB_SIZE 1024
+#define MAX_SLABS 4096
+
+/* Marks the end of the free list. */
+#define NONE UINT32_MAX
+
+typedef struct {
+    handle_t handle;
+    uint32_t generation; /* Odd while in use. */
+    uint32_t next_free;
+} slot_t;
+
+/* Slabs are never freed, so once a slab pointer has been published it can be
+ * read without the lock.
+ */
+static slot_t *slabs[MAX_SLABS];
+
+/* Protects everything below as well as the free list links. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t slab_count = 0;
+static uint32_t free_head = NONE;
+
+static slot_t *slot(uint32_t index) {
+    slot_t *slab = __atomic_load_n(&slabs[index / SLAB_SIZE], __ATOMIC_ACQUIRE);
+    return slab == NULL ? NULL : &slab[index % SLAB_SIZE];
+}
+
+/* Add a slab to the free list. Called with the lock held. */
+static int grow(void) {
+    if (slab_count == MAX_SLABS) {
+        return -1;
+    }
+    slot_t *slab = (slot_t*)calloc(SLAB_SIZE, sizeof(slot_t));
+    if (slab == NULL) {
+        return -1;
+    }
+    uint32_t base = slab_count * SLAB_SIZE;
+    size_t i;
+    for (i = 0; i < SLAB_SIZE; ++i) {
+        /* Slots keep their locks from one use to the next. */
+        pthread_rwlock_init(&slab[i].handle.lock, NULL);
+        pthread_mutex_init(&slab[i].handle.fill_lock, NULL);
+        slab[i].next_free = i + 1 < SLAB_SIZE ? base + i + 1 : free_head;
+    }
+    __atomic_store_n(&slabs[slab_count], slab, __ATOMIC_RELEASE);
+    ++slab_count;
+    free_head = base;
+    return 0;
+}
+
+handle_t *handle_alloc(void) {
+    pthread_mutex_lock(&lock);
+    if (free_head == NONE && grow() != 0) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+    uint32_t index = free_head;
+    slot_t *s = slot(index);
+    free_head = s->next_free;
+    uint32_t generation = s->generation + 1;
+    __atomic_store_n(&s->generation, generation, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+
+    s->handle.id = (uint64_t)generation << 32 | index;
+    return &s->handle;
+}
+
+handle_t *handle_get(uint64_t id) {
+    uint32_t index = id & 0xffffffff;
+    uint32_t generation = id >> 32;
+    if (index >= MAX_SLABS * SLAB_SIZE || !(generation & 1)) {
+        return NULL;
+    }
+    slot_t *s = slot(index);
+    if (s == NULL ||
+            __atomic_load_n(&s->generation, __ATOMIC_ACQUIRE) != generation) {
+        return NULL;
+    }
+    return &s->handle;
+}
+
+void handle_free(handle_t *h) {
+    uint32_t index = h->id & 0xffffffff;
+    slot_t *s = slot(index);
+
+    pthread_mutex_lock(&lock);
+    /* An even generation marks the slot free until it is next allocated. */
+    __atomic_store_n(&s->generation, s->generation + 1, __ATOMIC_RELEASE);
+    s->next_free = free_head;
+    free_head = index;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,26 @@
+#ifndef _EXECFS_HANDLES_H_
+#define _EXECFS_HANDLES_H_
+
+#include <stdint.h>
+#include "entry.h"
+
+/* Table of open handles. Handles live in slabs that are allocated as the
+ * number of open files grows and reused once they are released, so memory
+ * use is bounded by the peak number of open files rather than growing with
+ * the number of opens. Each handle is known to FUSE by an ID combining its
+ * slot with a generation count that changes whenever the slot is reused, so
+ * a stale ID can be detected instead of silently referring to another open.
+ */
+
+/* Allocate a handle. Its contents are uninitialised other than its id.
+ * Returns NULL if no memory is available or the table is full.
+ */
+handle_t *handle_alloc(void);
+
+/* Find the handle with the given ID, or NULL if it is not in use. */
+handle_t *handle_get(uint64_t id);
+
+/* Return a handle to the table. Its ID is no longer valid after this. */
+void handle_free(handle_t *h);
+
+#endif
@@ -1,86 +1,559 @@
 /* Underlying implementations of the interesting parts of this file system. */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "admission.h"
+#include "builtin.h"
 #include "entry.h"
-#include "fuse.h"
+#include "globals.h"
+#include "handles.h"
+#include "inputs.h"
+#include "output.h"
 #include "pipes.h"
+#include "range.h"
+#include "server.h"
+#include "sink.h"
+#include "stats.h"
+#include "writer.h"
 
-int file_open(entry_t *e, unsigned int rights, info_t *fi) {
-    char *mode = rights == O_RDONLY ? "r" : rights == O_WRONLY ? "w" : "rw";
+static int file_close_handle(handle_t *h);
+
+/* Called by the reaper when a command started by an open exits. */
+static void leave_slot(void *arg) {
+    admission_leave((entry_t*)arg);
+}
 
-    handle_t *h = (handle_t*)malloc(sizeof(handle_t));
+/* Allocate a handle with nothing attached. */
+static handle_t *handle_new(void) {
+    handle_t *h = handle_alloc();
     if (h == NULL) {
-        return -ENOMEM;
+        return NULL;
     }
     h->read_fd = h->write_fd = -1;
+    h->output = NULL;
+    h->range = NULL;
+    h->sink = NULL;
+    h->positional = 0;
+    h->server = NULL;
+    h->uid = 0;
+    h->input = NULL;
+    h->input_len = 0;
+    h->sent = 0;
+    h->replied = 0;
     h->buf = NULL;
     h->len = 0;
+    h->cache = 0;
+    h->zbuf = NULL;
+    cbuf_cache_init(&h->zcache);
+    h->writer = NULL;
+    return h;
+}
+
+/* Open a handle serving a complete output, taking over the caller's
+ * reference to it.
+ */
+static int open_output(output_t *o, uint64_t *fh) {
+    handle_t *h = handle_new();
+    if (h == NULL) {
+        output_put(o);
+        return -ENOMEM;
+    }
+    h->output = o;
+
+    *fh = h->id;
+    return 0;
+}
+
+/* Send a server mode handle's request, if it hasn't been already, and keep
+ * the reply to serve reads from. The request is sent by one thread at a time
+ * under the fill lock, without the handle's lock, so that it's only taken to
+ * hand over the input and publish the reply. Called without either lock.
+ */
+static int send_request(handle_t *h) {
+    pthread_rwlock_rdlock(&h->lock);
+    int replied = h->replied;
+    pthread_rwlock_unlock(&h->lock);
+    if (replied) {
+        return h->output == NULL ? -EIO : 0;
+    }
+
+    pthread_mutex_lock(&h->fill_lock);
+    pthread_rwlock_wrlock(&h->lock);
+    if (h->sent) {
+        /* Another thread sent it while we waited. */
+        int r = h->output == NULL ? -EIO : 0;
+        pthread_rwlock_unlock(&h->lock);
+        pthread_mutex_unlock(&h->fill_lock);
+        return r;
+    }
+    /* Writes fail from here on. */
+    h->sent = 1;
+    char *input = h->input;
+    size_t input_len = h->input_len;
+    h->input = NULL;
+    pthread_rwlock_unlock(&h->lock);
+
+    output_t *o = NULL;
+    int r = server_request(h->server, h->uid, input, input_len, &o);
+    free(input);
+
+    pthread_rwlock_wrlock(&h->lock);
+    h->output = r == 0 ? o : NULL;
+    h->replied = 1;
+    pthread_rwlock_unlock(&h->lock);
+    pthread_mutex_unlock(&h->fill_lock);
+    return r;
+}
+
+int file_open(entry_t *e, unsigned int rights, int flags, uid_t uid,
+        gid_t gid, uint64_t *fh) {
+    char *mode = rights == O_RDONLY ? "r" : rights == O_WRONLY ? "w" : "rw";
+
+    if ((e->stale_while_revalidate > 0 || e->refresh > 0) &&
+            rights == O_RDONLY) {
+        /* Readers are served the entry's latest output without waiting for
+         * the command.
+         */
+        output_t *o = output_acquire(e);
+        if (o == NULL) {
+            return -EIO;
+        }
+        return open_output(o, fh);
+    }
+
+    if (e->mode == MODE_RANGE) {
+        /* Commands are run as blocks are read. */
+        if (rights != O_RDONLY) {
+            return -EACCES;
+        }
+        handle_t *h = handle_new();
+        if (h == NULL) {
+            return -ENOMEM;
+        }
+        h->range = e;
+        *fh = h->id;
+        return 0;
+    }
+
+    if (e->mode == MODE_SINK) {
+        /* There is nothing to read, only files to append to. */
+        if (rights != O_WRONLY) {
+            return -EACCES;
+        }
+        int r = sink_open(e);
+        if (r != 0) {
+            return r;
+        }
+        handle_t *h = handle_new();
+        if (h == NULL) {
+            return -ENOMEM;
+        }
+        h->sink = e;
+        *fh = h->id;
+        return 0;
+    }
+
+    if (IS_BUILTIN(e)) {
+        /* Served without a command. */
+        if (rights != O_RDONLY) {
+            return -EACCES;
+        }
+        STATS_INC(builtin_opens);
+        if (e->mode == MODE_FILE) {
+            int fd = open(e->source, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return -errno;
+            }
+            handle_t *h = handle_new();
+            if (h == NULL) {
+                close(fd);
+                return -ENOMEM;
+            }
+            h->read_fd = fd;
+            h->positional = 1;
+            *fh = h->id;
+            return 0;
+        }
+        output_t *o = builtin_output(e);
+        if (o == NULL) {
+            return errno == 0 ? -EIO : -errno;
+        }
+        return open_output(o, fh);
+    }
+
+    if (e->mode == MODE_SERVER) {
+        if (rights == O_RDONLY) {
+            /* Nothing can be written, so ask straight away. */
+            output_t *o;
+            int r = server_request(e, uid, NULL, 0, &o);
+            if (r != 0) {
+                return r;
+            }
+            return open_output(o, fh);
+        }
+        handle_t *h = handle_new();
+        if (h == NULL) {
+            return -ENOMEM;
+        }
+        h->server = e;
+        h->uid = uid;
+        *fh = h->id;
+        return 0;
+    }
+
+    /* Inputs are produced before this open takes its own slot, so an entry
+     * never holds a slot while waiting for another.
+     */
+    output_t **inputs = NULL;
+    if (e->inputs_sz > 0) {
+        if (rights != O_RDONLY) {
+            return -EACCES;
+        }
+        int r = inputs_fetch(e, uid, gid, &inputs);
+        if (r != 0) {
+            return r;
+        }
+        mode = "rw";
+    }
+
+    int r = admission_enter(e, ADMIT_OPEN, !!(flags & O_NONBLOCK));
+    if (r != 0) {
+        if (inputs != NULL) {
+            inputs_put(inputs, e->inputs_sz);
+        }
+        return r;
+    }
+
+    handle_t *h = handle_new();
+    if (h == NULL) {
+        if (inputs != NULL) {
+            inputs_put(inputs, e->inputs_sz);
+        }
+        admission_leave(e);
+        return -ENOMEM;
+    }
     h->cache = e->cache;
+    if (h->cache && e->compress) {
+        h->zbuf = cbuf_new();
+        if (h->zbuf == NULL) {
+            if (inputs != NULL) {
+                inputs_put(inputs, e->inputs_sz);
+            }
+            handle_free(h);
+            admission_leave(e);
+            return -ENOMEM;
+        }
+    }
 
-    if (pipe_open(e->command, mode, &h->read_fd, &h->write_fd) != 0) {
-        free(h);
-        return -EBADF;
+    pid_t pid;
+    if (pipe_open(e->command, mode, &e->spawn, NULL, &h->read_fd,
+            &h->write_fd, &pid) != 0) {
+        /* Failures to set up the command, such as a nice it isn't allowed,
+         * are reported as they were met in the child.
+         */
+        r = errno != 0 ? -errno : -EBADF;
+        if (inputs != NULL) {
+            inputs_put(inputs, e->inputs_sz);
+        }
+        if (h->zbuf != NULL) {
+            cbuf_free(h->zbuf);
+        }
+        handle_free(h);
+        admission_leave(e);
+        return r;
     }
 
-    typedef char _handle_t_fits_in_uint64_t[sizeof(h) <= sizeof(fi->fh) ? 1 : -1];
-    fi->fh = (uint64_t)h;
+    /* The slot limits running commands, so it is given back when the command
+     * exits rather than when the file is closed.
+     */
+    pipe_release_notify(pid, leave_slot, e);
+
+    if (inputs != NULL) {
+        /* The command's stdin now belongs to the feeder. */
+        r = inputs_feed(inputs, e->inputs_sz, h->write_fd);
+        h->write_fd = -1;
+        if (r != 0) {
+            (void)file_close_handle(h);
+            return r;
+        }
+    }
+
+    if (e->async_write && h->write_fd != -1) {
+        h->writer = writer_new(h->write_fd,
+            e->write_buffer > 0 ? e->write_buffer : write_buffer_size);
+        if (h->writer == NULL) {
+            (void)file_close_handle(h);
+            return -ENOMEM;
+        }
+    }
+
+    *fh = h->id;
 
     return 0;
 }
 
-int file_read(char *buf, size_t size, off_t offset, info_t *fi) {
-    handle_t *h = (handle_t*)fi->fh;
-    if (h->cache) {
-        if (offset + size > h->len) {
-            /* We need to fill up the cache. */
-            int extra_bytes = offset + size - h->len;
+int file_open_stats(uint64_t *fh) {
+    /* Snapshot the statistics at open time. */
+    size_t len;
+    char *buf = stats_render(&len);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    output_t *o = output_new(buf, len);
+    if (o == NULL) {
+        free(buf);
+        return -ENOMEM;
+    }
+    return open_output(o, fh);
+}
 
-            char *r_buf = (char*)realloc(h->buf, h->len + extra_bytes);
-            if (r_buf == NULL) {
-                return -ENOMEM;
+/* Copy the part of data covered by a read request. */
+static int read_range(char *buf, size_t size, off_t offset, const char *data,
+        size_t data_len) {
+    if (offset >= data_len) {
+        return 0;
+    }
+    if (size > data_len - offset) {
+        size = data_len - offset;
+    }
+    memcpy(buf, data + offset, size);
+    return size;
+}
+
+/* Read from a handle's command. Returns a negative errno value on failure. */
+static ssize_t child_read(handle_t *h, char *buf, size_t size) {
+    ssize_t sz = read(h->read_fd, buf, size);
+    return sz < 0 ? -errno : sz;
+}
+
+/* Length of a caching handle's cached output so far. */
+static size_t cached_len(handle_t *h) {
+    return h->zbuf != NULL ? cbuf_len(h->zbuf) : h->len;
+}
+
+/* Add at most end - cached_len(h) bytes of command output to a caching
+ * handle's cache with a single read. The read happens without the handle's
+ * lock, which is only taken to grow the cache. Called with the fill lock
+ * held. Returns the number of bytes added or a negative errno value.
+ */
+static ssize_t fill_cache_once(handle_t *h, size_t end) {
+    size_t extra_bytes = end - cached_len(h);
+
+    if (h->zbuf != NULL) {
+        char *r_buf = (char*)malloc(extra_bytes);
+        if (r_buf == NULL) {
+            return -ENOMEM;
+        }
+        ssize_t sz = child_read(h, r_buf, extra_bytes);
+        if (sz > 0) {
+            pthread_rwlock_wrlock(&h->lock);
+            int r = cbuf_append(h->zbuf, r_buf, sz);
+            pthread_rwlock_unlock(&h->lock);
+            if (r != 0) {
+                sz = -ENOMEM;
             }
+        }
+        free(r_buf);
+        return sz;
+    }
+
+    /* Readers only look at the first len bytes, and only the filler moves
+     * the buffer, so the rest of it can be read into without the lock.
+     */
+    pthread_rwlock_wrlock(&h->lock);
+    char *r_buf = (char*)realloc(h->buf, h->len + extra_bytes);
+    if (r_buf != NULL) {
+        h->buf = r_buf;
+    }
+    pthread_rwlock_unlock(&h->lock);
+    if (r_buf == NULL) {
+        return -ENOMEM;
+    }
+
+    ssize_t sz = child_read(h, h->buf + h->len, extra_bytes);
+    size_t got = sz < 0 ? 0 : sz;
+
+    pthread_rwlock_wrlock(&h->lock);
+    if (got < extra_bytes) {
+        /* Argh, we couldn't read enough. Let's realloc less so we don't leak
+         * memory. This only shrinks the buffer, so a failure leaves the
+         * larger one in place.
+         */
+        r_buf = (char*)realloc(h->buf, h->len + got);
+        if (r_buf != NULL || h->len + got == 0) {
             h->buf = r_buf;
+        }
+    }
+    h->len += got;
+    pthread_rwlock_unlock(&h->lock);
+    return sz;
+}
 
-            ssize_t sz = read(h->read_fd, h->buf + h->len, extra_bytes);
-            if (sz < extra_bytes) {
-                /* Argh, we couldn't read enough. Let's realloc less so we
-                 * don't leak memory.
-                 */
-                h->buf = (char*)realloc(h->buf, h->len + sz);
-                /* FIXME: The above shouldn't fail because we're reducing
-                 * h->buf, but we shouldn't really rely on that.
-                 */
-            }
-            h->len += sz;
+/* Fill a caching handle's cache towards covering [offset, end). When several
+ * threads share a handle their reads can arrive out of order, so this keeps
+ * reading until the cache reaches offset. It stops at the first read past it
+ * rather than waiting for all of [offset, end), so an interactive command is
+ * never waited on for more output than it has produced. Only one thread
+ * fills at a time. Called without the handle's lock.
+ */
+static int fill_cache(handle_t *h, off_t offset, size_t end) {
+    int r = 0;
+    pthread_mutex_lock(&h->fill_lock);
+    /* Another filler may have covered the range while we waited. The cache
+     * only grows with the fill lock held, so its length can be read here.
+     */
+    while (cached_len(h) < end) {
+        ssize_t sz = fill_cache_once(h, end);
+        if (sz <= 0) {
+            /* The end of the output, or an error. */
+            r = sz;
+            break;
         }
+        if (cached_len(h) > offset) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&h->fill_lock);
+    return r;
+}
 
-        ssize_t len = size;
-        if (len + offset > h->len) {
-            len -= len + offset - h->len;
+int file_read(char *buf, size_t size, off_t offset, uint64_t fh) {
+    handle_t *h = handle_get(fh);
+    if (h == NULL) {
+        return -EBADF;
+    }
+    if (h->server != NULL) {
+        int r = send_request(h);
+        if (r != 0) {
+            return r;
         }
-        if (len < 0) {
-            return 0;
+    }
+
+    int r;
+    if (h->output != NULL) {
+        if (h->output->z == NULL) {
+            /* Outputs are immutable and a raw one doesn't use zcache. */
+            return output_read(h->output, &h->zcache, buf, size, offset);
         }
-        memcpy(buf, h->buf + offset, len);
-        return len;
+        pthread_rwlock_wrlock(&h->lock);
+        r = output_read(h->output, &h->zcache, buf, size, offset);
+        pthread_rwlock_unlock(&h->lock);
+        return r;
+
+    } else if (h->range != NULL) {
+        if (!h->range->compress) {
+            return range_read(h->range, &h->zcache, buf, size, offset);
+        }
+        pthread_rwlock_wrlock(&h->lock);
+        r = range_read(h->range, &h->zcache, buf, size, offset);
+        pthread_rwlock_unlock(&h->lock);
+        return r;
+
+    } else if (h->positional) {
+        ssize_t sz = pread(h->read_fd, buf, size, offset);
+        return sz < 0 ? -errno : sz;
+
+    } else if (h->zbuf != NULL) {
+        r = fill_cache(h, offset, offset + size);
+        if (r != 0) {
+            return r;
+        }
+        /* Even reads of what is already cached go through zcache. */
+        pthread_rwlock_wrlock(&h->lock);
+        r = cbuf_read(h->zbuf, &h->zcache, buf, size, offset);
+        pthread_rwlock_unlock(&h->lock);
+        return r;
+
+    } else if (h->cache) {
+        pthread_rwlock_rdlock(&h->lock);
+        if (offset + size > h->len) {
+            /* We need to fill up the cache, which may move it. Another reader
+             * may be doing so already, in which case fill_cache waits for it
+             * and may have nothing left to do.
+             */
+            pthread_rwlock_unlock(&h->lock);
+            r = fill_cache(h, offset, offset + size);
+            if (r != 0) {
+                return r;
+            }
+            pthread_rwlock_rdlock(&h->lock);
+        }
+        r = read_range(buf, size, offset, h->buf, h->len);
+        pthread_rwlock_unlock(&h->lock);
+        return r;
 
     } else {
-        return read(h->read_fd, buf, size);
+        return child_read(h, buf, size);
     }
 }
 
-int file_write(const char *buf, size_t size, off_t offset, info_t *fi) {
+int file_write(const char *buf, size_t size, off_t offset, uint64_t fh) {
     (void)offset;
-    handle_t *h = (handle_t*)fi->fh;
+    handle_t *h = handle_get(fh);
+    if (h == NULL) {
+        return -EBADF;
+    }
+    if (h->server != NULL) {
+        pthread_rwlock_wrlock(&h->lock);
+        if (h->sent) {
+            /* The request has gone. */
+            pthread_rwlock_unlock(&h->lock);
+            return -EIO;
+        }
+        char *input = (char*)realloc(h->input, h->input_len + size);
+        if (input == NULL) {
+            pthread_rwlock_unlock(&h->lock);
+            return -ENOMEM;
+        }
+        memcpy(input + h->input_len, buf, size);
+        h->input = input;
+        h->input_len += size;
+        pthread_rwlock_unlock(&h->lock);
+        return size;
+    }
+    if (h->sink != NULL) {
+        return sink_write(h->sink, buf, size);
+    }
+    if (h->writer != NULL) {
+        return writer_write(h->writer, buf, size);
+    }
     return write(h->write_fd, buf, size);
 }
 
-int file_close(info_t *fi) {
-    handle_t *h = (handle_t*)fi->fh;
+int file_flush(uint64_t fh) {
+    handle_t *h = handle_get(fh);
+    if (h == NULL) {
+        return -EBADF;
+    }
+    if (h->server != NULL) {
+        return send_request(h);
+    }
+    if (h->sink != NULL) {
+        return sink_flush(h->sink);
+    }
+    if (h->writer != NULL) {
+        return writer_flush(h->writer);
+    }
+    return 0;
+}
+
+static int file_close_handle(handle_t *h) {
+    if (h->server != NULL) {
+        (void)send_request(h);
+    }
+    if (h->sink != NULL) {
+        /* Writes are committed by the time the file is closed. */
+        (void)sink_flush(h->sink);
+    }
+    if (h->writer != NULL) {
+        /* Let any buffered data drain before the child sees EOF. */
+        (void)writer_close(h->writer);
+    }
     if (h->read_fd != -1) {
         close(h->read_fd);
     }
@@ -90,6 +563,21 @@ int file_close(info_t *fi) {
     if (h->cache && h->buf != NULL) {
         free(h->buf);
     }
-    free(h);
+    if (h->zbuf != NULL) {
+        cbuf_free(h->zbuf);
+    }
+    cbuf_cache_free(&h->zcache);
+    if (h->output != NULL) {
+        output_put(h->output);
+    }
+    handle_free(h);
     return 0;
 }
+
+int file_close(uint64_t fh) {
+    handle_t *h = handle_get(fh);
+    if (h == NULL) {
+        return -EBADF;
+    }
+    return file_close_handle(h);
+}
@@ -1,13 +1,19 @@
 #ifndef _EXECFS_IMPL_H_
 #define _EXECFS_IMPL_H_
 
+#include <stdint.h>
 #include <string.h>
 #include "entry.h"
-#include "fuse.h"
 
-int file_open(entry_t *e, unsigned int rights, info_t *fi);
-int file_read(char *buf, size_t size, off_t offset, info_t *fi);
-int file_write(const char *buf, size_t size, off_t offset, info_t *fi);
-int file_close(info_t *fi);
+/* Open files are identified by the ID of their handle, returned through fh
+ * by the open functions.
+ */
+int file_open(entry_t *e, unsigned int rights, int flags, uid_t uid,
+        gid_t gid, uint64_t *fh);
+int file_open_stats(uint64_t *fh);
+int file_read(char *buf, size_t size, off_t offset, uint64_t fh);
+int file_write(const char *buf, size_t size, off_t offset, uint64_t fh);
+int file_flush(uint64_t fh);
+int file_close(uint64_t fh);
 
 #endif
@@ -0,0 +1,168 @@
+/* Feeding entries' outputs to other entries' commands. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "builtin.h"
+#include "cbuf.h"
+#include "entry.h"
+#include "inputs.h"
+#include "lookup.h"
+#include "macros.h"
+#include "output.h"
+#include "server.h"
+#include "stats.h"
+
+/* Size of the chunks compressed outputs are decompressed in to be written. */
+#define FEED_CHUNK (64 * 1024)
+
+typedef struct {
+    output_t **outputs;
+    size_t len;
+    int fd;
+} feed_t;
+
+void inputs_put(output_t **outputs, size_t len) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        if (outputs[i] != NULL) {
+            output_put(outputs[i]);
+        }
+    }
+    free(outputs);
+}
+
+/* Produce one input's output, the same way an open of it would. */
+static int fetch(entry_t *in, uid_t uid, output_t **out) {
+    if (IS_BUILTIN(in)) {
+        *out = builtin_output(in);
+        return *out == NULL ? -EIO : 0;
+    }
+    if (in->stale_while_revalidate > 0 || in->refresh > 0) {
+        *out = output_acquire(in);
+        return *out == NULL ? -EIO : 0;
+    }
+    if (in->mode == MODE_SERVER) {
+        return server_request(in, uid, NULL, 0, out);
+    }
+    *out = output_run(in, NULL, ADMIT_INTERNAL);
+    return *out == NULL ? -EIO : 0;
+}
+
+int inputs_fetch(entry_t *e, uid_t uid, gid_t gid, output_t ***outputs) {
+    /* Nobody gets to read an input through an entry that they couldn't read
+     * directly.
+     */
+    size_t i;
+    for (i = 0; i < e->inputs_sz; ++i) {
+        if (!(access_rights(e->inputs[i], uid, gid) & R)) {
+            return -EACCES;
+        }
+    }
+
+    output_t **os = (output_t**)calloc(e->inputs_sz, sizeof(output_t*));
+    if (os == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < e->inputs_sz; ++i) {
+        int r = fetch(e->inputs[i], uid, &os[i]);
+        if (r != 0) {
+            os[i] = NULL;
+            inputs_put(os, e->inputs_sz);
+            return r;
+        }
+        STATS_ADD(input_bytes, os[i]->len);
+    }
+    STATS_ADD(input_fetches, e->inputs_sz);
+    *outputs = os;
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sz = write(fd, buf, len);
+        if (sz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += sz;
+        len -= sz;
+    }
+    return 0;
+}
+
+static void *feed_thread(void *arg) {
+    feed_t *f = (feed_t*)arg;
+
+    size_t i;
+    for (i = 0; i < f->len; ++i) {
+        output_t *o = f->outputs[i];
+        if (o->z == NULL) {
+            if (write_all(f->fd, o->data, o->len) != 0) {
+                /* The command stopped reading. */
+                break;
+            }
+            continue;
+        }
+
+        char chunk[FEED_CHUNK];
+        cbuf_cache_t cache;
+        cbuf_cache_init(&cache);
+        off_t offset = 0;
+        int failed = 0;
+        for (;;) {
+            int sz = output_read(o, &cache, chunk, sizeof(chunk), offset);
+            if (sz <= 0) {
+                failed = sz < 0;
+                break;
+            }
+            if (write_all(f->fd, chunk, sz) != 0) {
+                failed = 1;
+                break;
+            }
+            offset += sz;
+        }
+        cbuf_cache_free(&cache);
+        if (failed) {
+            break;
+        }
+    }
+
+    close(f->fd);
+    inputs_put(f->outputs, f->len);
+    free(f);
+    return NULL;
+}
+
+int inputs_feed(output_t **outputs, size_t len, int fd) {
+    feed_t *f = (feed_t*)malloc(sizeof(feed_t));
+    if (f == NULL) {
+        close(fd);
+        inputs_put(outputs, len);
+        return -ENOMEM;
+    }
+    f->outputs = outputs;
+    f->len = len;
+    f->fd = fd;
+
+    /* The command may produce output before it has consumed all of its input,
+     * so its stdin has to be written independently of whoever reads it.
+     */
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int r = pthread_create(&thread, &attr, feed_thread, f);
+    pthread_attr_destroy(&attr);
+    if (r != 0) {
+        close(fd);
+        inputs_put(outputs, len);
+        free(f);
+        return -r;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _EXECFS_INPUTS_H_
+#define _EXECFS_INPUTS_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "entry.h"
+#include "output.h"
+
+/* Composition of entries inside the daemon. An entry with inputs has the
+ * outputs of those entries written, in order, to its command's stdin instead
+ * of the command reading them back through the mount.
+ */
+
+/* Produce the output of each of an entry's inputs on behalf of uid and gid,
+ * reusing cached outputs where the input has them. Fails with -EACCES if they
+ * can't read any of the inputs. This happens before the entry itself takes an
+ * admission slot, so it never waits on a slot it holds. On success, returns 0
+ * and an array of e->inputs_sz outputs in *outputs. Otherwise returns a
+ * negative errno value.
+ */
+int inputs_fetch(entry_t *e, uid_t uid, gid_t gid, output_t ***outputs);
+
+/* Release outputs returned by inputs_fetch() without feeding them. */
+void inputs_put(output_t **outputs, size_t len);
+
+/* Write fetched outputs to fd from a background thread, then close fd and
+ * release the outputs. Both are owned by the feeder from here on, even on
+ * failure. Returns 0 or a negative errno value.
+ */
+int inputs_feed(output_t **outputs, size_t len, int fd);
+
+#endif
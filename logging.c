@@ -0,0 +1,217 @@
+/* Asynchronous logging through per-thread ring buffers. */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logging.h"
+#include "stats.h"
+
+/* Messages per ring, which must be a power of two, and the longest message
+ * kept. Longer messages are truncated.
+ */
+#define RING_SLOTS 256
+#define MESSAGE_MAX 256
+
+/* How often the writer looks for new messages, in milliseconds. */
+#define DRAIN_INTERVAL 50
+
+typedef struct {
+    time_t time;
+    char text[MESSAGE_MAX];
+} message_t;
+
+/* A single-producer, single-consumer ring. Only the owning thread advances
+ * head and only the writer advances tail, so neither needs a lock.
+ */
+typedef struct ring {
+    message_t slots[RING_SLOTS];
+    unsigned long head;
+    unsigned long tail;
+    int dead; /* The owning thread has exited. */
+    struct ring *next;
+} ring_t;
+
+static FILE *log_file = NULL;
+static int log_level = LOG_LEVEL_DEBUG;
+
+/* Every ring yet to be freed. The lock is only taken by threads when they
+ * first log and by the writer as it drains.
+ */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static ring_t *rings = NULL;
+
+static __thread ring_t *my_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_t writer;
+static int writer_running = 0;
+static int stopping = 0;
+
+/* Set before the log file is closed so that threads still running stop
+ * logging. Messages they were publishing as it was set are lost.
+ */
+static int closed = 0;
+
+static const char *level_names[] = {
+    [LOG_LEVEL_DEBUG] = "DEBUG",
+    [LOG_LEVEL_INFO] = "INFO",
+    [LOG_LEVEL_WARNING] = "WARNING",
+    [LOG_LEVEL_ERROR] = "ERROR",
+};
+
+static void ring_exit(void *arg) {
+    /* Leave the ring for the writer to drain and free. */
+    __atomic_store_n(&((ring_t*)arg)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void make_ring_key(void) {
+    (void)pthread_key_create(&ring_key, ring_exit);
+}
+
+static ring_t *get_ring(void) {
+    if (my_ring != NULL) {
+        return my_ring;
+    }
+    ring_t *r = (ring_t*)calloc(1, sizeof(ring_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    pthread_once(&ring_key_once, make_ring_key);
+    (void)pthread_setspecific(ring_key, r);
+
+    pthread_mutex_lock(&rings_lock);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_lock);
+    my_ring = r;
+    return r;
+}
+
+void log_write(int level, const char *file, int line, const char *format,
+        ...) {
+    if (__atomic_load_n(&closed, __ATOMIC_ACQUIRE) || log_file == NULL ||
+            level < log_level) {
+        return;
+    }
+    ring_t *r = get_ring();
+    if (r == NULL) {
+        STATS_INC(log_dropped);
+        return;
+    }
+
+    unsigned long head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SLOTS) {
+        /* Full. Rather than wait for the writer, lose the message. */
+        STATS_INC(log_dropped);
+        return;
+    }
+
+    message_t *m = &r->slots[head & (RING_SLOTS - 1)];
+    m->time = time(NULL);
+    int len = snprintf(m->text, sizeof(m->text), "%s %s:%d: ",
+        level_names[level], file, line);
+    if (len < sizeof(m->text)) {
+        va_list ap;
+        va_start(ap, format);
+        (void)vsnprintf(m->text + len, sizeof(m->text) - len, format, ap);
+        va_end(ap);
+    }
+
+    /* Publish the message. */
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Write out everything queued and free the rings of exited threads. Returns
+ * the number of messages written.
+ */
+static size_t drain(void) {
+    size_t written = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    ring_t **prev = &rings;
+    ring_t *r;
+    while ((r = *prev) != NULL) {
+        /* Check for death before draining so that no message published
+         * before the thread exited is missed.
+         */
+        int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        unsigned long tail = r->tail;
+        for (; tail != head; ++tail) {
+            message_t *m = &r->slots[tail & (RING_SLOTS - 1)];
+            struct tm tm;
+            char stamp[32];
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S",
+                localtime_r(&m->time, &tm));
+            fprintf(log_file, "%s %s\n", stamp, m->text);
+            ++written;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        if (dead) {
+            *prev = r->next;
+            free(r);
+        } else {
+            prev = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    if (written > 0) {
+        fflush(log_file);
+    }
+    return written;
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (drain() == 0) {
+            struct timespec ts = {
+                .tv_sec = 0,
+                .tv_nsec = DRAIN_INTERVAL * 1000000L,
+            };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+int log_init(int level, const char *filename) {
+    log_file = fopen(filename, "a");
+    if (log_file == NULL) {
+        return -1;
+    }
+    log_level = level;
+    return 0;
+}
+
+int log_start(void) {
+    if (log_file == NULL || writer_running) {
+        return 0;
+    }
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        return -1;
+    }
+    writer_running = 1;
+    return 0;
+}
+
+void log_close(void) {
+    if (log_file == NULL) {
+        return;
+    }
+    __atomic_store_n(&closed, 1, __ATOMIC_RELEASE);
+    if (writer_running) {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+        pthread_join(writer, NULL);
+        writer_running = 0;
+    }
+    (void)drain();
+    fclose(log_file);
+    log_file = NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef _EXECFS_LOGGING_H_
+#define _EXECFS_LOGGING_H_
+
+/* Logging. Messages below LOG_MIN_LEVEL, which the Makefile sets according to
+ * the build type, are compiled out entirely. Others are formatted by the
+ * calling thread into a ring buffer of its own and written to the log file by
+ * a background thread, so logging never blocks on I/O or on other threads. If
+ * a thread's ring is full its message is dropped and counted in the
+ * statistics instead.
+ */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+    #define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* Log a message at one of the levels above, e.g. LOG(DEBUG, "x is %d", x). */
+#define LOG(level, args...) do { \
+        if (LOG_LEVEL_##level >= LOG_MIN_LEVEL) { \
+            log_write(LOG_LEVEL_##level, __FILE__, __LINE__, args); \
+        } \
+    } while (0)
+
+/* Open the log file, discarding messages below level at runtime. Without a
+ * call to this, nothing is logged. Returns 0 on success.
+ */
+int log_init(int level, const char *filename);
+
+/* Start the thread writing messages to the log file. This is separate from
+ * log_init() so that it happens after the process has daemonised. Messages
+ * logged before it is started wait in their ring. Returns 0 on success.
+ */
+int log_start(void);
+
+/* Write out any remaining messages and close the log file. Anything logged
+ * from then on is discarded.
+ */
+void log_close(void);
+
+void log_write(int level, const char *file, int line, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif
@@ -0,0 +1,132 @@
+/* Hash index of entries. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "assert.h"
+#include "entry.h"
+#include "globals.h"
+#include "lookup.h"
+#include "macros.h"
+
+/* Open addressing table of entries, kept at most half full. It is built
+ * before the file system starts and only read afterwards, so needs no lock.
+ */
+static entry_t **table = NULL;
+static size_t table_sz = 0;
+
+static ino_t stats_ino = 0;
+
+/* 64-bit FNV-1a. */
+static uint64_t hash(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *name != '\0'; ++name) {
+        h ^= (unsigned char)*name;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Slot holding name, or the empty slot where it would go. */
+static size_t slot(const char *name) {
+    size_t i = hash(name) & (table_sz - 1);
+    while (table[i] != NULL && strcmp(table[i]->path, name)) {
+        i = (i + 1) & (table_sz - 1);
+    }
+    return i;
+}
+
+/* Inode numbers handed out so far, in a table the size of the entry table.
+ * Only needed while they are assigned.
+ */
+static ino_t *inos = NULL;
+
+/* Claim the inode number derived from a name, or on the off chance of a
+ * collision the next free one, avoiding those reserved by FUSE.
+ */
+static ino_t make_ino(const char *name) {
+    ino_t ino = (ino_t)hash(name);
+    for (;;) {
+        if (ino > ROOT_INO) {
+            size_t i = (size_t)ino & (table_sz - 1);
+            while (inos[i] != 0 && inos[i] != ino) {
+                i = (i + 1) & (table_sz - 1);
+            }
+            if (inos[i] == 0) {
+                inos[i] = ino;
+                return ino;
+            }
+        }
+        ++ino;
+    }
+}
+
+int lookup_init(void) {
+    /* Room for every entry and the statistics file at most half full. */
+    table_sz = 16;
+    while (table_sz < (entries_sz + 1) * 2) {
+        table_sz *= 2;
+    }
+    table = (entry_t**)calloc(table_sz, sizeof(entry_t*));
+    inos = (ino_t*)calloc(table_sz, sizeof(ino_t));
+    if (table == NULL || inos == NULL) {
+        free(table);
+        free(inos);
+        table = NULL;
+        inos = NULL;
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        table[slot(entries[i].path)] = &entries[i];
+    }
+
+    if (stats_path != NULL) {
+        stats_ino = make_ino(stats_path);
+    }
+    for (i = 0; i < entries_sz; ++i) {
+        entries[i].ino = make_ino(entries[i].path);
+    }
+    free(inos);
+    inos = NULL;
+    return 0;
+}
+
+entry_t *lookup(const char *path) {
+    if (path[0] != '/') {
+        /* We were passed a path outside this mount point (?) */
+        return NULL;
+    }
+    return table[slot(path + 1)];
+}
+
+ino_t lookup_stats_ino(void) {
+    return stats_ino;
+}
+
+/* Determine the permissions of a given file in the context of the user
+ * operating on it.
+ */
+unsigned int access_rights(entry_t *entry, uid_t user, gid_t group) {
+    unsigned int rights;
+
+    assert(entry != NULL);
+
+    if (user == uid) {
+        rights = (entry->u_r ? R : 0)
+            | (entry->u_w ? W : 0)
+            | (entry->u_x ? X : 0);
+    } else if (group == gid) {
+        rights = (entry->g_r ? R : 0)
+            | (entry->g_w ? W : 0)
+            | (entry->g_x ? X : 0);
+    } else {
+        rights = (entry->o_r ? R : 0)
+            | (entry->o_w ? W : 0)
+            | (entry->o_x ? X : 0);
+    }
+    return rights;
+}
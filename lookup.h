@@ -0,0 +1,29 @@
+#ifndef _EXECFS_LOOKUP_H_
+#define _EXECFS_LOOKUP_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "entry.h"
+
+/* Inode number of the root of the mount point. */
+#define ROOT_INO 1
+
+/* Index the configured entries by name and assign each, and the statistics
+ * file if any, an inode number derived from a hash of its name. These stay
+ * the same from one mount to the next as long as the names do. Returns 0 on
+ * success.
+ */
+int lookup_init(void);
+
+/* Find an entry by path, or NULL if there is none. */
+entry_t *lookup(const char *path);
+
+/* Inode number of the statistics file. */
+ino_t lookup_stats_ino(void);
+
+/* Determine the permissions (R, W and X) of an entry in the context of the
+ * user operating on it.
+ */
+unsigned int access_rights(entry_t *entry, uid_t user, gid_t group);
+
+#endif
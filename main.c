@@ -3,21 +3,23 @@
 #include <fuse.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
-#include <log.h>
 
 #include "config.h"
 #include "entry.h"
+#include "execfs.h"
 #include "fileops.h"
 #include "globals.h"
+#include "logging.h"
 
 /* Configuration file to read. */
 static char *config_filename = NULL;
@@ -25,31 +27,19 @@ static char *config_filename = NULL;
 /* Debugging enabled. */
 static int debug = 0;
 
-/* Entries to present to the user in the mount point. */
-entry_t *entries = NULL;
-size_t entries_sz = 0;
-
-/* Identity of the mounter. This will become the owner of all entries in the
- * mount point.
- */
-uid_t uid;
-gid_t gid;
-
-/* Size in bytes to assign to each file. */
-#define DEFAULT_SIZE (10 * 1024) /* 10 KB */
-size_t size = DEFAULT_SIZE;
-
 /* Debugging functions. */
 static void debug_dump_entries(void) {
     assert(entries_sz != PARSE_FAIL);
     size_t i;
     fprintf(stderr, "Entries table has %u entries:\n", (unsigned int)entries_sz);
     for (i = 0; i < entries_sz; ++i) {
-        fprintf(stderr, " Path: %s; -%c%c%c%c%c%c%c%c%c; Exec: %s; Size %d\n", entries[i].path, 
+        fprintf(stderr, " Path: %s; -%c%c%c%c%c%c%c%c%c; Exec: %s; Size %lld\n", entries[i].path, 
             entries[i].u_r?'r':'-', entries[i].u_w?'w':'-', entries[i].u_x?'x':'-',
             entries[i].g_r?'r':'-', entries[i].g_w?'w':'-', entries[i].g_x?'x':'-',
             entries[i].o_r?'r':'-', entries[i].o_w?'w':'-', entries[i].o_x?'x':'-',
-            entries[i].command, entries[i].size);
+            entries[i].command != NULL ? entries[i].command :
+            entries[i].source != NULL ? entries[i].source : "(sink)",
+            (long long)entries[i].size);
     }
 }
 static int debug_printf(char *format, ...) {
@@ -62,17 +52,21 @@ static int debug_printf(char *format, ...) {
     return result;
 }
 
-/* Signal handling functions. */
-static void handle_sigchld(int signal) {
-    /* Collect any zombie children. */
-    pid_t pid;
-    do {
-        pid = waitpid(-1, NULL, WNOHANG);
-    } while (pid > 0);
-}
-
-static void install_signal_handlers(void) {
-    signal(SIGCHLD, handle_sigchld);
+/* Parse a count given as an argument, which must be a non-negative decimal
+ * number. Returns 0 on success.
+ */
+static int parse_count(const char *arg, const char *what, size_t *count) {
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno != 0 ||
+            n > SIZE_MAX) {
+        fprintf(stderr, "Invalid %s %s passed\n", what, arg);
+        errno = EINVAL;
+        return -1;
+    }
+    *count = n;
+    return 0;
 }
 
 /* Parse command line arguments. Returns 0 on success, non-zero on failure. */
@@ -83,8 +77,16 @@ static int parse_args(int argc, char **argv, int *last) {
         {"fuse", no_argument, 0, 'f'},
         {"help", no_argument, 0, '?'},
         {"log", required_argument, 0, 'l'},
+        {"max-children", required_argument, 0, 'm'},
+        {"max-queue", required_argument, 0, 'q'},
+        {"refresh-concurrency", required_argument, 0, 'r'},
+        {"refresh-jitter", required_argument, 0, 'j'},
         {"size", required_argument, 0, 's'},
+        {"stats", required_argument, 0, 'S'},
+        {"trace", required_argument, 0, 't'},
         {"version", no_argument, 0, 'v'},
+        {"write-buffer", required_argument, 0, 'w'},
+        {"writer-threads", required_argument, 0, 'W'},
         {0, 0, 0, 0},
     };
     int index;
@@ -117,7 +119,7 @@ static int parse_args(int argc, char **argv, int *last) {
                 assert(last != NULL);
                 *last = optind;
                 if (log_file != NULL) {
-                    if (log_init(debug ? DEBUG : INFO, log_file, NULL, 1) != 0) {
+                    if (log_init(debug ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO, log_file) != 0) {
                         fprintf(stderr, "Failed to open log file %s\n", log_file);
                         return -1;
                     }
@@ -131,6 +133,40 @@ static int parse_args(int argc, char **argv, int *last) {
                     return -1;
                 }
                 break;
+            } case 'm': {
+                if (parse_count(optarg, "maximum children", &max_children) != 0) {
+                    return -1;
+                }
+                break;
+            } case 'q': {
+                if (parse_count(optarg, "maximum queue", &max_queue) != 0) {
+                    return -1;
+                }
+                break;
+            } case 'r': {
+                if (parse_count(optarg, "refresh concurrency", &refresh_concurrency) != 0) {
+                    return -1;
+                }
+                break;
+            } case 'j': {
+                int j = atoi(optarg);
+                if (j < 0 || j > 100) {
+                    fprintf(stderr, "Invalid refresh jitter %s passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                refresh_jitter = j;
+                break;
+            } case 'S': {
+                if (stats_path != NULL) {
+                    free(stats_path);
+                }
+                stats_path = strdup(optarg);
+                if (stats_path == NULL) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+                break;
             } case 's': {
                 size_t sz = atoi(optarg);
                 if (sz == 0) {
@@ -140,9 +176,37 @@ static int parse_args(int argc, char **argv, int *last) {
                 }
                 size = sz;
                 break;
+            } case 't': {
+                if (trace != NULL) {
+                    fclose(trace);
+                }
+                trace = fopen(optarg, "w");
+                if (trace == NULL) {
+                    fprintf(stderr, "Failed to open trace file %s\n", optarg);
+                    return -1;
+                }
+                break;
             } case 'v': {
                 printf("execfs version %s\n", VERSION);
                 exit(0);
+            } case 'w': {
+                size_t sz = atoi(optarg);
+                if (sz == 0) {
+                    fprintf(stderr, "Invalid write buffer size %s passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                write_buffer_size = sz;
+                break;
+            } case 'W': {
+                if (parse_count(optarg, "writer thread count", &writer_threads) != 0) {
+                    return -1;
+                } else if (writer_threads == 0) {
+                    fprintf(stderr, "Invalid writer thread count %s passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                break;
             } case '?': {
                 printf("Usage: %s options -f fuse_options\n"
                        " -c, --config FILE     Read configuration from the given file. This argument\n"
@@ -154,12 +218,33 @@ static int parse_args(int argc, char **argv, int *last) {
                        " -?, --help            Print this usage information.\n"
                        " -l, --log FILE        Write logging information to FILE. Without this\n"
                        "                       argument no logging is performed.\n"
+                       " --max-children N      Maximum number of commands running at once (default\n"
+                       "                       unlimited). Further opens wait in a FIFO queue.\n"
+                       " --max-queue N         Maximum number of opens queued waiting to run their\n"
+                       "                       command (default 8, or 0 with -s as each waiting\n"
+                       "                       open holds a FUSE thread). Opens beyond this fail\n"
+                       "                       with EAGAIN.\n"
+                       " --refresh-concurrency N\n"
+                       "                       Maximum number of scheduled refreshes to run at once\n"
+                       "                       (default 4, 0 for unlimited).\n"
+                       " --refresh-jitter PERCENT\n"
+                       "                       Randomly offset scheduled refreshes by up to this\n"
+                       "                       percentage of their interval (default 10).\n"
                        " -s, --size SIZE       A size in bytes to report each file entry as having\n"
                        "                       (default 10). The argument exists because some programs\n"
                        "                       will stat a file before reading it and only read as\n"
                        "                       many bytes as its reported size. Increase this value if\n"
                        "                       you find the output of your executed commands is being\n"
-                       "                       truncated when read.\n",
+                       "                       truncated when read.\n"
+                       " --stats NAME          Present a read-only file NAME in the mount point\n"
+                       "                       containing runtime statistics.\n"
+                       " --trace FILE          Record every file operation in FILE, for replaying\n"
+                       "                       against the library with tools/replay.\n"
+                       " --write-buffer SIZE   Maximum bytes of written data to buffer per open file\n"
+                       "                       for entries with async_write enabled (default 1MB).\n"
+                       "                       Writers block when this much data is pending.\n"
+                       " --writer-threads N    Number of threads shared by every async_write file and\n"
+                       "                       sink destination to write buffered data (default 8).\n",
                        argv[0]);
                 exit(0);
             } default: {
@@ -188,31 +273,20 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    entries = parse_config(&entries_sz, config_filename, debug ? &debug_printf : NULL);
-    if (entries_sz == PARSE_FAIL) {
-        if (errno != 0) {
-            perror("Failed to parse configuration file");
-        } else {
-            fprintf(stderr, "Failed to parse configuration file\n");
-        }
-        return -1;
-    }
+    int r = execfs_load(config_filename, debug ? &debug_printf : NULL);
 
     /* We don't need the configuration file any more. */
     free(config_filename);
     config_filename = NULL;
 
+    if (r != 0) {
+        return -1;
+    }
+
     if (debug) {
         debug_dump_entries();
     }
 
-    /* Install our signal handlers now. */
-    install_signal_handlers();
-
-    /* Set the owner of the mount point entries. */
-    uid = geteuid();
-    gid = getegid();
-
     /* Adjust arguments to hide any that we handled from FUSE. */
     --last_arg;
     assert(last_arg > 0);
@@ -221,9 +295,27 @@ int main(int argc, char **argv) {
     argv += last_arg;
     argc -= last_arg;
     assert(argv[argc] == NULL);
+
+    /* A single-threaded FUSE loop has no thread to spare for waiting opens. */
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s")) {
+            max_queue = 0;
+            max_waiting = 0;
+        }
+    }
+
+    /* Have FUSE use our inode numbers rather than make up its own. */
+    char **fuse_argv = (char**)malloc(sizeof(char*) * (argc + 2));
+    if (fuse_argv == NULL) {
+        return -1;
+    }
+    memcpy(fuse_argv, argv, sizeof(char*) * argc);
+    fuse_argv[argc++] = "-ouse_ino";
+    fuse_argv[argc] = NULL;
+    argv = fuse_argv;
     if (debug) {
         fprintf(stderr, "Altered argument parameters:\n");
-        int i;
         for (i = 0; i < argc; ++i) {
             fprintf(stderr, "%d: %s\n", i, argv[i]);
         }
@@ -0,0 +1,295 @@
+/* Captured command output shared between handles. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "admission.h"
+#include "entry.h"
+#include "globals.h"
+#include "inputs.h"
+#include "output.h"
+#include "pipes.h"
+#include "scheduler.h"
+#include "stats.h"
+
+/* Protects the current output and refreshing flag of every entry. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled whenever a background run finishes. */
+static pthread_cond_t refreshed = PTHREAD_COND_INITIALIZER;
+
+static time_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+output_t *output_new(char *data, size_t len) {
+    output_t *o = (output_t*)malloc(sizeof(output_t));
+    if (o == NULL) {
+        return NULL;
+    }
+    o->data = data;
+    o->z = NULL;
+    o->len = len;
+    o->produced = now();
+    o->refs = 1;
+    return o;
+}
+
+output_t *output_new_compressed(cbuf_t *z) {
+    output_t *o = output_new(NULL, cbuf_len(z));
+    if (o != NULL) {
+        o->z = z;
+    }
+    return o;
+}
+
+void output_get(output_t *o) {
+    __sync_fetch_and_add(&o->refs, 1);
+}
+
+void output_put(output_t *o) {
+    if (__sync_sub_and_fetch(&o->refs, 1) == 0) {
+        free(o->data);
+        if (o->z != NULL) {
+            cbuf_free(o->z);
+        }
+        free(o);
+    }
+}
+
+int output_read(output_t *o, cbuf_cache_t *cache, char *buf, size_t size,
+        off_t offset) {
+    if (o->z != NULL) {
+        return cbuf_read(o->z, cache, buf, size, offset);
+    }
+    if (offset >= o->len) {
+        return 0;
+    }
+    if (size > o->len - offset) {
+        size = o->len - offset;
+    }
+    memcpy(buf, o->data + offset, size);
+    return size;
+}
+
+output_t *output_run(entry_t *e, char *const *env, admit_t kind) {
+    /* Shared outputs are produced on behalf of the mounting user. */
+    output_t **inputs = NULL;
+    if (e->inputs_sz > 0 && inputs_fetch(e, uid, gid, &inputs) != 0) {
+        return NULL;
+    }
+
+    if (admission_enter(e, kind, 0) != 0) {
+        if (inputs != NULL) {
+            inputs_put(inputs, e->inputs_sz);
+        }
+        return NULL;
+    }
+
+    int fd, in_fd = -1;
+    pid_t pid;
+    if (pipe_open(e->command, inputs == NULL ? "r" : "rw", &e->spawn, env, &fd,
+            inputs == NULL ? NULL : &in_fd, &pid) != 0) {
+        if (inputs != NULL) {
+            inputs_put(inputs, e->inputs_sz);
+        }
+        admission_leave(e);
+        return NULL;
+    }
+    if (inputs != NULL && inputs_feed(inputs, e->inputs_sz, in_fd) != 0) {
+        close(fd);
+        pipe_release(pid);
+        admission_leave(e);
+        return NULL;
+    }
+
+    /* Compressed output is compressed as it arrives so that the whole of it
+     * is never held uncompressed.
+     */
+    cbuf_t *z = NULL;
+    if (e->compress) {
+        z = cbuf_new();
+        if (z == NULL) {
+            close(fd);
+            pipe_release(pid);
+            admission_leave(e);
+            return NULL;
+        }
+    }
+
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    int failed = 0;
+    for (;;) {
+        if (len == cap) {
+            if (z != NULL && len > 0) {
+                if (cbuf_append(z, buf, len) != 0) {
+                    failed = 1;
+                    break;
+                }
+                len = 0;
+            } else {
+                cap = cap == 0 ? 4096 : cap * 2;
+                char *b = (char*)realloc(buf, cap);
+                if (b == NULL) {
+                    failed = 1;
+                    break;
+                }
+                buf = b;
+            }
+        }
+        ssize_t sz = read(fd, buf + len, cap - len);
+        if (sz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = 1;
+            break;
+        } else if (sz == 0) {
+            break;
+        }
+        len += sz;
+    }
+    close(fd);
+
+    int status = pipe_wait(pid);
+    admission_leave(e);
+    if (!failed && z != NULL &&
+            (cbuf_append(z, buf, len) != 0 || cbuf_finish(z) != 0)) {
+        failed = 1;
+    }
+    if (failed || status == -1 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+        free(buf);
+        if (z != NULL) {
+            cbuf_free(z);
+        }
+        return NULL;
+    }
+
+    output_t *o;
+    if (z != NULL) {
+        free(buf);
+        o = output_new_compressed(z);
+        if (o == NULL) {
+            cbuf_free(z);
+        }
+    } else {
+        o = output_new(buf, len);
+        if (o == NULL) {
+            free(buf);
+        }
+    }
+    return o;
+}
+
+/* Run an entry's command and swap in its output. The caller must have claimed
+ * the run by setting the entry's refreshing flag.
+ */
+static int refresh(entry_t *e) {
+    output_t *o = output_run(e, NULL, ADMIT_BACKGROUND);
+
+    pthread_mutex_lock(&lock);
+    if (o != NULL) {
+        /* Swap in the new output. Handles still reading the old one hold
+         * their own reference.
+         */
+        if (e->current != NULL) {
+            output_put(e->current);
+        }
+        e->current = o;
+    } else {
+        /* The previous output, if any, is kept. */
+        STATS_INC(refresh_failures);
+    }
+    STATS_INC(refresh_runs);
+    e->refreshing = 0;
+    ++e->refreshes;
+    e->attempted = now();
+    pthread_cond_broadcast(&refreshed);
+    pthread_mutex_unlock(&lock);
+    return o == NULL ? -1 : 0;
+}
+
+int output_refresh(entry_t *e) {
+    pthread_mutex_lock(&lock);
+    if (e->refreshing) {
+        /* Someone else is already doing the work. */
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    e->refreshing = 1;
+    pthread_mutex_unlock(&lock);
+
+    return refresh(e);
+}
+
+static void *refresh_thread(void *arg) {
+    (void)refresh((entry_t*)arg);
+    return NULL;
+}
+
+/* Start a background run of an entry's command unless one is already going.
+ * Called with the lock held.
+ */
+static void refresh_async(entry_t *e) {
+    if (e->refreshing) {
+        return;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, refresh_thread, e) == 0) {
+        pthread_detach(thread);
+        e->refreshing = 1;
+    }
+}
+
+output_t *output_acquire(entry_t *e) {
+    /* Without the scheduler, refresh entries fall back to being refreshed by
+     * reads as if the interval were stale_while_revalidate. Failed runs are
+     * retried no more often than this either, rather than by every open.
+     */
+    time_t interval = e->refresh > 0 ? e->refresh : e->stale_while_revalidate;
+
+    pthread_mutex_lock(&lock);
+
+    if (e->refresh > 0 && scheduler_running()) {
+        /* Runs are left entirely to the scheduler. Only wait for its first
+         * attempt if there is nothing to serve yet; once a run has finished
+         * without output, fail straight away rather than wait for the next.
+         */
+        while (e->current == NULL && e->refreshes == 0) {
+            pthread_cond_wait(&refreshed, &lock);
+        }
+    } else if (e->current == NULL) {
+        /* Nothing to serve yet, so we have no choice but to wait for the
+         * command. Wait for one run to finish rather than for success so that
+         * a failing command doesn't block the open forever.
+         */
+        if (e->refreshes == 0 || e->refreshing ||
+                now() - e->attempted >= interval) {
+            unsigned int gen = e->refreshes;
+            refresh_async(e);
+            while (e->current == NULL && e->refreshing &&
+                    e->refreshes == gen) {
+                pthread_cond_wait(&refreshed, &lock);
+            }
+        }
+    } else if (now() - e->current->produced >= interval &&
+            now() - e->attempted >= interval) {
+        refresh_async(e);
+    }
+
+    output_t *o = e->current;
+    if (o != NULL) {
+        output_get(o);
+    }
+    pthread_mutex_unlock(&lock);
+    return o;
+}
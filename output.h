@@ -0,0 +1,60 @@
+#ifndef _EXECFS_OUTPUT_H_
+#define _EXECFS_OUTPUT_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include "admission.h"
+#include "cbuf.h"
+#include "entry.h"
+
+/* The complete output of one run of a command. Outputs are immutable once
+ * created and reference counted so that an entry's latest output can be
+ * replaced while open handles continue to read the one they started with.
+ */
+typedef struct output {
+    char *data;  /* Raw contents, or NULL if compressed. */
+    cbuf_t *z;   /* Compressed contents, or NULL if raw. */
+    size_t len;
+    time_t produced; /* Monotonic time in seconds at which the run finished. */
+    int refs;
+} output_t;
+
+/* Create an output holding a single reference, taking ownership of data or
+ * a finished compressed buffer respectively.
+ */
+output_t *output_new(char *data, size_t len);
+output_t *output_new_compressed(cbuf_t *z);
+void output_get(output_t *o);
+void output_put(output_t *o);
+
+/* Read part of an output. The cache is only used for compressed outputs and
+ * belongs to the reader. Returns the number of bytes read or a negative errno
+ * value.
+ */
+int output_read(output_t *o, cbuf_cache_t *cache, char *buf, size_t size,
+    off_t offset);
+
+/* Run an entry's command to completion and capture its output, compressed if
+ * the entry asks for it. The command is given the environment env, or the
+ * daemon's own if env is NULL, once admitted as kind. Returns NULL if the
+ * command could not be run or exited unsuccessfully.
+ */
+output_t *output_run(entry_t *e, char *const *env, admit_t kind);
+
+/* Run an entry's command and make its output the entry's latest, unless a run
+ * is already in progress. On failure the previous output is kept and non-zero
+ * is returned.
+ */
+int output_refresh(entry_t *e);
+
+/* Return a reference to the latest output of an entry with
+ * stale_while_revalidate or refresh set. For the former, if the output has
+ * expired it is returned anyway and a single background run is started to
+ * replace it. The latter never start a run unless the scheduler isn't
+ * running, in which case they behave like the former. Blocks only when the
+ * entry has not yet finished a run. Returns NULL on failure.
+ */
+output_t *output_acquire(entry_t *e);
+
+#endif
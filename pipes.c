@@ -1,24 +1,128 @@
 /* Functionality that extends popen. */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include "pipes.h"
 
-/* Shell to use when opening a file read/write. */
+/* Shell to use when opening a file. */
 #define SHELL "/bin/sh"
 
-/* Basically popen(path, "rw"), but popen doesn't let you do this. */
-static int popen_rw(const char *path, int *read_fd, int *write_fd) {
+/* glibc provides no wrapper for ioprio_set. */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+void spawn_attr_init(spawn_attr_t *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->rlimit_cpu = -1;
+    attr->rlimit_as = -1;
+    attr->rlimit_nofile = -1;
+}
+
+static int set_limit(int resource, long long value) {
+    if (value < 0) {
+        return 0;
+    }
+    struct rlimit rl = {
+        .rlim_cur = value,
+        .rlim_max = value,
+    };
+    return setrlimit(resource, &rl);
+}
+
+/* Apply spawn attributes to the current process. This is called in the child
+ * between fork and exec so it must stick to async-signal-safe functions.
+ * Returns non-zero with errno set on failure.
+ */
+static int apply_attr(const spawn_attr_t *attr) {
+    if (attr->nice != 0) {
+        /* -1 is a valid priority, so only errno tells it from failure. */
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+        if ((prio == -1 && errno != 0) ||
+                setpriority(PRIO_PROCESS, 0, prio + attr->nice) != 0) {
+            return -1;
+        }
+    }
+    if (attr->ionice_class != 0 &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_PRIO_VALUE(attr->ionice_class, attr->ionice_level)) != 0) {
+        return -1;
+    }
+    if (attr->has_cpus &&
+            sched_setaffinity(0, sizeof(attr->cpus), &attr->cpus) != 0) {
+        return -1;
+    }
+    if (set_limit(RLIMIT_CPU, attr->rlimit_cpu) != 0 ||
+            set_limit(RLIMIT_AS, attr->rlimit_as) != 0 ||
+            set_limit(RLIMIT_NOFILE, attr->rlimit_nofile) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Make from available as to in the child, without close-on-exec. When they
+ * are the same descriptor dup2() does nothing, so the flag is cleared
+ * instead. Async-signal-safe.
+ */
+static int move_fd(int from, int to) {
+    if (from == to) {
+        return fcntl(to, F_SETFD, 0);
+    }
+    return dup2(from, to) < 0 ? -1 : 0;
+}
+
+/* Report why the child couldn't run its command to the parent and exit.
+ * Async-signal-safe.
+ */
+static void child_fail(int status_fd) {
+    int err = errno;
+    if (write(status_fd, &err, sizeof(err)) < 0) {
+        /* Nothing more we can do. The parent sees the child exit instead. */
+    }
+    _exit(127);
+}
+
+/* Basically popen(path, mode), but popen doesn't let you open a process
+ * read/write or adjust it before it runs. Either of read_fd and write_fd may
+ * be NULL to leave the corresponding standard stream of the child untouched.
+ */
+static int popen_rw(const char *path, const spawn_attr_t *attr,
+        char *const *env, int *read_fd, int *write_fd, pid_t *child) {
     /* What we're going to do is create two pipes that we'll use as the read
      * and write file descriptors. Stdout and stdin, repsectively, in the
-     * opened process need to connect to these pipes.
+     * opened process need to connect to these pipes. They are created
+     * close-on-exec so that commands don't inherit each other's pipes and
+     * prevent EOF being seen.
      */
-    int input[2], output[2];
-    if (pipe(input) != 0 || pipe(output) != 0) {
-        return -1;
+    int input[2] = { -1, -1 }, output[2] = { -1, -1 };
+    int err;
+    if ((write_fd != NULL && pipe2(input, O_CLOEXEC) != 0) ||
+            (read_fd != NULL && pipe2(output, O_CLOEXEC) != 0)) {
+        goto popen_rw_fail;
+    }
+
+    /* A third pipe carries the errno of any failure to set the child up or
+     * run the command. Exec closes it, so the parent sees either an errno or
+     * EOF once the command is running.
+     */
+    int status[2];
+    if (pipe2(status, O_CLOEXEC) != 0) {
+        goto popen_rw_fail;
     }
 
     /* Flush standard streams to avoid aberrations after forking. This
@@ -28,62 +132,369 @@ static int popen_rw(const char *path, int *read_fd, int *write_fd) {
 
     pid_t pid = fork();
     if (pid == -1) {
-        close(input[0]);
-        close(input[1]);
-        close(output[0]);
-        close(output[1]);
-        return -1;
+        close(status[0]);
+        close(status[1]);
+        goto popen_rw_fail;
     } else if (pid == 0) {
         /* We are the child. */
 
-        /* Close the ends of the pipe we don't need. */
-        close(input[1]); close(output[0]);
-
         /* Overwrite our stdin and stdout such that they connect to the pipes.
+         * The originals are closed on exec, unless they already were stdin or
+         * stdout.
          */
-        if (dup2(input[0], STDIN_FILENO) < 0 || dup2(output[1], STDOUT_FILENO) < 0) {
-            exit(1);
+        if ((write_fd != NULL && move_fd(input[0], STDIN_FILENO) != 0) ||
+                (read_fd != NULL && move_fd(output[1], STDOUT_FILENO) != 0)) {
+            child_fail(status[1]);
+        }
+
+        if (attr != NULL && apply_attr(attr) != 0) {
+            child_fail(status[1]);
         }
 
         /* Overwrite our image with the command to execute. Note that exec will
          * only return if it fails.
          */
-        (void)execl(SHELL, "sh", "-c", path, NULL);
-        exit(1);
-    } else {
-        /* We are the parent. */
+        if (env != NULL) {
+            (void)execle(SHELL, "sh", "-c", path, NULL, env);
+        } else {
+            (void)execl(SHELL, "sh", "-c", path, NULL);
+        }
+        child_fail(status[1]);
+    }
 
-        /* Close the ends of the pipe we don't need. */
-        close(input[0]); close(output[1]);
+    /* We are the parent. */
+    close(status[1]);
+    ssize_t sz;
+    while ((sz = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+    }
+    close(status[0]);
+    if (sz == sizeof(err)) {
+        /* The command never ran. */
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        errno = err;
+        goto popen_rw_fail;
+    }
 
-        /* Pack the file descriptors we do need into the handle. */
-        *read_fd = output[0];
+    /* Close the ends of the pipe we don't need and pack the file descriptors
+     * we do need into the handle.
+     */
+    if (write_fd != NULL) {
+        close(input[0]);
         *write_fd = input[1];
-        return 0;
     }
-    /* Unreachable. */
+    if (read_fd != NULL) {
+        close(output[1]);
+        *read_fd = output[0];
+    }
+    *child = pid;
+    return 0;
+
+popen_rw_fail:
+    err = errno;
+    if (input[0] != -1) {
+        close(input[0]);
+        close(input[1]);
+    }
+    if (output[0] != -1) {
+        close(output[0]);
+        close(output[1]);
+    }
+    errno = err;
+    return -1;
 }
 
-int pipe_open(char *command, char *mode, int *read_fd, int *write_fd) {
+int pipe_open(char *command, char *mode, const spawn_attr_t *attr,
+        char *const *env, int *read_fd, int *write_fd, pid_t *pid) {
 
     if (!strcmp(mode, "r")) {
-        FILE *f = popen(command, "r");
-        if (f == NULL) {
-            return -1;
-        }
-        *read_fd = fileno(f);
-        return 0;
+        return popen_rw(command, attr, env, read_fd, NULL, pid);
 
     } else if (!strcmp(mode, "w")) {
-        FILE *f = popen(command, "w");
-        if (f == NULL) {
+        return popen_rw(command, attr, env, NULL, write_fd, pid);
+
+    }
+
+    /* "rw" */
+    return popen_rw(command, attr, env, read_fd, write_fd, pid);
+}
+
+extern char **environ;
+
+char **pipe_env(char *const *extra) {
+    size_t n = 0, m = 0, i, j;
+    while (environ[n] != NULL) {
+        ++n;
+    }
+    while (extra[m] != NULL) {
+        ++m;
+    }
+
+    char **env = (char**)malloc(sizeof(char*) * (n + m + 1));
+    if (env == NULL) {
+        return NULL;
+    }
+
+    /* Copy the daemon's environment, leaving out anything overridden. */
+    size_t k = 0;
+    for (i = 0; i < n; ++i) {
+        size_t name_len = strcspn(environ[i], "=");
+        for (j = 0; j < m; ++j) {
+            if (!strncmp(environ[i], extra[j], name_len) &&
+                    extra[j][name_len] == '=') {
+                break;
+            }
+        }
+        if (j == m) {
+            env[k++] = environ[i];
+        }
+    }
+    for (j = 0; j < m; ++j) {
+        env[k++] = extra[j];
+    }
+    env[k] = NULL;
+    return env;
+}
+
+int pipe_wait(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
             return -1;
         }
-        *write_fd = fileno(f);
+    }
+    return status;
+}
+
+/* Children that have been released but not yet reaped. Each is watched
+ * through a pidfd, which becomes readable once the child exits, so that it's
+ * reaped (and its slot handed back) straight away. Children aren't collected
+ * from a SIGCHLD handler because a handler reaping every child would steal
+ * the exit status of children in pipe_wait(). Kernels without pidfds fall
+ * back to polling.
+ */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#define REAP_INTERVAL_MS 100
+typedef struct {
+    pid_t pid;
+    int pidfd;
+    void (*exited)(void *arg);
+    void *arg;
+} orphan_t;
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static orphan_t *orphans = NULL;
+static size_t orphans_sz = 0;
+static size_t orphans_cap = 0;
+static int reaper_running = 0;
+/* Written to when an orphan is added, to wake the reaper from poll(). */
+static int reaper_wake[2] = { -1, -1 };
+
+/* Reap the orphan at index i if it has exited, with orphans_lock held.
+ * Returns whether it was removed; the lock is dropped while calling back.
+ */
+static int reap_orphan(size_t i) {
+    if (waitpid(orphans[i].pid, NULL, WNOHANG) == 0) {
         return 0;
+    }
+    /* Reaped (or not ours to reap). */
+    orphan_t o = orphans[i];
+    orphans[i] = orphans[--orphans_sz];
+    if (o.pidfd >= 0) {
+        close(o.pidfd);
+    }
+    if (o.exited != NULL) {
+        /* The callback may take locks of its own. */
+        pthread_mutex_unlock(&orphans_lock);
+        o.exited(o.arg);
+        pthread_mutex_lock(&orphans_lock);
+    }
+    return 1;
+}
 
+static void *reaper(void *arg) {
+    struct pollfd *fds = NULL;
+    pid_t *pids = NULL;
+    size_t cap = 0;
+
+    pthread_mutex_lock(&orphans_lock);
+    for (;;) {
+        /* Snapshot what to watch; only this thread removes orphans. */
+        if (orphans_sz + 1 > cap) {
+            size_t n = orphans_sz + 16;
+            struct pollfd *f = (struct pollfd*)realloc(fds, sizeof(*f) * n);
+            if (f != NULL) {
+                fds = f;
+            }
+            pid_t *p = (pid_t*)realloc(pids, sizeof(*p) * n);
+            if (p != NULL) {
+                pids = p;
+            }
+            if (f != NULL && p != NULL) {
+                cap = n;
+            }
+        }
+        size_t nfds = 0;
+        int timeout = -1;
+        if (cap > 0) {
+            fds[0].fd = reaper_wake[0];
+            fds[0].events = POLLIN;
+            nfds = 1;
+        } else {
+            timeout = REAP_INTERVAL_MS;
+        }
+        for (size_t i = 0; i < orphans_sz; ++i) {
+            if (orphans[i].pidfd < 0 || nfds == 0 || nfds == cap) {
+                timeout = REAP_INTERVAL_MS;
+                continue;
+            }
+            fds[nfds].fd = orphans[i].pidfd;
+            fds[nfds].events = POLLIN;
+            pids[nfds] = orphans[i].pid;
+            ++nfds;
+        }
+        pthread_mutex_unlock(&orphans_lock);
+
+        int ready = poll(fds, nfds, timeout);
+
+        pthread_mutex_lock(&orphans_lock);
+        if (ready > 0 && (fds[0].revents & POLLIN) != 0) {
+            char buf[64];
+            while (read(reaper_wake[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        for (size_t j = 1; ready > 0 && j < nfds; ++j) {
+            if (fds[j].revents == 0) {
+                continue;
+            }
+            for (size_t i = 0; i < orphans_sz; ++i) {
+                if (orphans[i].pid == pids[j]) {
+                    reap_orphan(i);
+                    break;
+                }
+            }
+        }
+        if (timeout >= 0) {
+            /* Some aren't being watched, so check on all of them. */
+            size_t i = 0;
+            while (i < orphans_sz) {
+                if (!reap_orphan(i)) {
+                    ++i;
+                }
+            }
+        }
     }
-    
-    /* "rw" */
-    return popen_rw(command, read_fd, write_fd);
+    /* Unreachable. */
+    return NULL;
+}
+
+void pipe_release(pid_t pid) {
+    pipe_release_notify(pid, NULL, NULL);
+}
+
+void pipe_release_notify(pid_t pid, void (*exited)(void *arg), void *arg) {
+    /* Many children have already finished by the time they are released. */
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+        if (exited != NULL) {
+            exited(arg);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&orphans_lock);
+    if (!reaper_running) {
+        /* Started on demand rather than at startup because FUSE forks when
+         * daemonising, which would leave the thread behind.
+         */
+        pthread_t thread;
+        if (pipe2(reaper_wake, O_CLOEXEC | O_NONBLOCK) == 0) {
+            if (pthread_create(&thread, NULL, reaper, NULL) == 0) {
+                pthread_detach(thread);
+                reaper_running = 1;
+            } else {
+                close(reaper_wake[0]);
+                close(reaper_wake[1]);
+            }
+        }
+    }
+    if (orphans_sz == orphans_cap) {
+        size_t cap = orphans_cap == 0 ? 16 : orphans_cap * 2;
+        orphan_t *o = (orphan_t*)realloc(orphans, sizeof(orphan_t) * cap);
+        if (o == NULL) {
+            /* Nothing sensible to do but leave a zombie, and report it as
+             * exited now rather than never.
+             */
+            pthread_mutex_unlock(&orphans_lock);
+            if (exited != NULL) {
+                exited(arg);
+            }
+            return;
+        }
+        orphans = o;
+        orphans_cap = cap;
+    }
+    orphans[orphans_sz].pid = pid;
+    orphans[orphans_sz].pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (orphans[orphans_sz].pidfd >= 0) {
+        fcntl(orphans[orphans_sz].pidfd, F_SETFD, FD_CLOEXEC);
+    }
+    orphans[orphans_sz].exited = exited;
+    orphans[orphans_sz].arg = arg;
+    ++orphans_sz;
+    pthread_mutex_unlock(&orphans_lock);
+
+    char c = 0;
+    if (write(reaper_wake[1], &c, 1) < 0) {
+        /* Already full, so the reaper will wake anyway. */
+    }
+}
+
+/* Wait up to timeout_ms for a child to exit, reaping it if it does. Returns
+ * whether it was reaped.
+ */
+static int wait_exit(pid_t pid, int timeout_ms) {
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        pid_t r = waitpid(pid, NULL, WNOHANG);
+        if (r != 0 && !(r < 0 && errno == EINTR)) {
+            /* Reaped (or not ours to reap). */
+            break;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        long elapsed = (ts.tv_sec - start.tv_sec) * 1000L +
+            (ts.tv_nsec - start.tv_nsec) / 1000000L;
+        if (elapsed >= timeout_ms) {
+            if (pidfd >= 0) {
+                close(pidfd);
+            }
+            return 0;
+        }
+        if (pidfd >= 0) {
+            struct pollfd fd = { .fd = pidfd, .events = POLLIN };
+            (void)poll(&fd, 1, (int)(timeout_ms - elapsed));
+        } else {
+            struct timespec interval = { 0, REAP_INTERVAL_MS * 1000000L / 10 };
+            nanosleep(&interval, NULL);
+        }
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    return 1;
+}
+
+void pipe_stop(pid_t pid, int timeout_ms) {
+    if (wait_exit(pid, timeout_ms)) {
+        return;
+    }
+    kill(pid, SIGTERM);
+    if (wait_exit(pid, timeout_ms)) {
+        return;
+    }
+    kill(pid, SIGKILL);
+    (void)pipe_wait(pid);
 }
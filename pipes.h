@@ -1,9 +1,69 @@
 #ifndef _EXECFS_PIPES_H_
 #define _EXECFS_PIPES_H_
 
+#include <sched.h>
+#include <sys/types.h>
+
+/* Scheduling and resource settings applied to a command before it is
+ * executed.
+ */
+typedef struct {
+    int nice;          /* Niceness increment, 0 to leave unchanged. */
+    int ionice_class;  /* One of the IOPRIO_CLASS_* values, 0 to leave unchanged. */
+    int ionice_level;  /* Priority within the best-effort/realtime classes. */
+    int has_cpus;      /* Whether cpus should be applied. */
+    cpu_set_t cpus;    /* CPU affinity. */
+    long long rlimit_cpu;    /* CPU seconds, -1 for unlimited. */
+    long long rlimit_as;     /* Address space bytes, -1 for unlimited. */
+    long long rlimit_nofile; /* Open files, -1 for unlimited. */
+} spawn_attr_t;
+
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+/* Initialise attributes to leave everything inherited from the daemon. */
+void spawn_attr_init(spawn_attr_t *attr);
+
 /* Thin wrapper around popen with some extra functionality. Returns a packed
- * set of file descriptors in read_fd, write_fd. Returns non-zero on failure.
+ * set of file descriptors in read_fd, write_fd and the child's process ID in
+ * pid. The settings in attr, if non-NULL, are applied to the command. The
+ * command is given the environment env, or the daemon's own if env is NULL.
+ * Returns non-zero with errno set on failure, including when the settings
+ * couldn't be applied or the shell couldn't be run.
+ *
+ * The caller owns the child and must eventually pass it to either
+ * pipe_wait(), pipe_stop() or pipe_release().
+ */
+int pipe_open(char *command, char *mode, const spawn_attr_t *attr,
+    char *const *env, int *read_fd, int *write_fd, pid_t *pid);
+
+/* Build an environment consisting of the daemon's own plus the NULL
+ * terminated list of "NAME=value" strings in extra, which take precedence.
+ * Only the returned array needs to be freed. Returns NULL on failure.
+ */
+char **pipe_env(char *const *extra);
+
+/* Wait for a child to exit. Returns its status as from waitpid() or -1 on
+ * failure.
+ */
+int pipe_wait(pid_t pid);
+
+/* Wait up to timeout_ms for a child that has been asked to exit, then send it
+ * SIGTERM and wait as long again, and finally SIGKILL it. The child is reaped
+ * either way.
+ */
+void pipe_stop(pid_t pid, int timeout_ms);
+
+/* Give up ownership of a child whose exit status is not needed. It will be
+ * reaped in the background once it exits.
+ */
+void pipe_release(pid_t pid);
+
+/* As pipe_release(), but call exited(arg) once the child has exited. This is
+ * called from the background reaper, or from here if the child has already
+ * exited.
  */
-int pipe_open(char *command, char *mode, int *read_fd, int *write_fd);
+void pipe_release_notify(pid_t pid, void (*exited)(void *arg), void *arg);
 
 #endif
@@ -0,0 +1,232 @@
+/* Range mode, where an entry's command generates one block of a large file at
+ * a time.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "entry.h"
+#include "output.h"
+#include "pipes.h"
+#include "range.h"
+#include "stats.h"
+
+typedef struct rblock {
+    off_t index;
+    output_t *output; /* NULL while loading. */
+    struct rblock *chain; /* Next in hash bucket. */
+    struct rblock *prev, *next; /* Neighbours in LRU order, most recent first. */
+} rblock_t;
+
+typedef struct range {
+    rblock_t **buckets;
+    size_t buckets_sz;
+    rblock_t *head, *tail;
+    size_t count;
+} range_t;
+
+/* Protects the block cache of every entry. Commands are run without it. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled when a block finishes loading. */
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER;
+
+static range_t *get_range(entry_t *e) {
+    if (e->range == NULL) {
+        range_t *r = (range_t*)calloc(1, sizeof(range_t));
+        if (r == NULL) {
+            return NULL;
+        }
+        r->buckets_sz = e->range_cache * 2 + 1;
+        r->buckets = (rblock_t**)calloc(r->buckets_sz, sizeof(rblock_t*));
+        if (r->buckets == NULL) {
+            free(r);
+            return NULL;
+        }
+        e->range = r;
+    }
+    return e->range;
+}
+
+static rblock_t **bucket(range_t *r, off_t index) {
+    return &r->buckets[index % r->buckets_sz];
+}
+
+static void lru_unlink(range_t *r, rblock_t *b) {
+    if (b->prev != NULL) {
+        b->prev->next = b->next;
+    } else {
+        r->head = b->next;
+    }
+    if (b->next != NULL) {
+        b->next->prev = b->prev;
+    } else {
+        r->tail = b->prev;
+    }
+}
+
+static void lru_push(range_t *r, rblock_t *b) {
+    b->prev = NULL;
+    b->next = r->head;
+    if (r->head != NULL) {
+        r->head->prev = b;
+    } else {
+        r->tail = b;
+    }
+    r->head = b;
+}
+
+static void remove_block(range_t *r, rblock_t *b) {
+    rblock_t **p = bucket(r, b->index);
+    while (*p != b) {
+        p = &(*p)->chain;
+    }
+    *p = b->chain;
+    lru_unlink(r, b);
+    --r->count;
+    if (b->output != NULL) {
+        output_put(b->output);
+    }
+    free(b);
+}
+
+/* Drop least recently used blocks until the cache is within its limit. Blocks
+ * still loading are skipped.
+ */
+static void evict(entry_t *e, range_t *r) {
+    rblock_t *b = r->tail;
+    while (r->count > e->range_cache && b != NULL) {
+        rblock_t *prev = b->prev;
+        if (b->output != NULL) {
+            remove_block(r, b);
+        }
+        b = prev;
+    }
+}
+
+/* Run the command for one block. */
+static output_t *load(entry_t *e, off_t index) {
+    off_t offset = index * e->block_size;
+    off_t length = e->size - offset;
+    if (length > e->block_size) {
+        length = e->block_size;
+    }
+
+    char offset_var[64], length_var[64];
+    snprintf(offset_var, sizeof(offset_var), "EXECFS_OFFSET=%lld", (long long)offset);
+    snprintf(length_var, sizeof(length_var), "EXECFS_LENGTH=%lld", (long long)length);
+    char *extra[] = { offset_var, length_var, NULL };
+    char **env = pipe_env(extra);
+    if (env == NULL) {
+        return NULL;
+    }
+
+    output_t *o = output_run(e, env, ADMIT_INTERNAL);
+    free(env);
+    STATS_INC(range_blocks_run);
+    return o;
+}
+
+/* Return a reference to the output for a block, running the command if it is
+ * not cached. Concurrent readers of a block being loaded wait for it rather
+ * than running the command again.
+ */
+static output_t *get_block(entry_t *e, off_t index) {
+    pthread_mutex_lock(&lock);
+    range_t *r = get_range(e);
+    if (r == NULL) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+
+    for (;;) {
+        rblock_t *b = *bucket(r, index);
+        while (b != NULL && b->index != index) {
+            b = b->chain;
+        }
+
+        if (b != NULL && b->output == NULL) {
+            /* Someone else is loading it. It may fail and vanish, so look
+             * again afterwards.
+             */
+            pthread_cond_wait(&loaded, &lock);
+            continue;
+        }
+
+        if (b != NULL) {
+            lru_unlink(r, b);
+            lru_push(r, b);
+            output_t *o = b->output;
+            output_get(o);
+            pthread_mutex_unlock(&lock);
+            STATS_INC(range_blocks_hit);
+            return o;
+        }
+
+        /* Claim the block and load it without the lock. */
+        b = (rblock_t*)calloc(1, sizeof(rblock_t));
+        if (b == NULL) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        b->index = index;
+        b->chain = *bucket(r, index);
+        *bucket(r, index) = b;
+        lru_push(r, b);
+        ++r->count;
+        pthread_mutex_unlock(&lock);
+
+        output_t *o = load(e, index);
+
+        pthread_mutex_lock(&lock);
+        if (o == NULL) {
+            remove_block(r, b);
+        } else {
+            b->output = o;
+            output_get(o);
+            evict(e, r);
+        }
+        pthread_cond_broadcast(&loaded);
+        pthread_mutex_unlock(&lock);
+        return o;
+    }
+}
+
+int range_read(entry_t *e, cbuf_cache_t *cache, char *buf, size_t size,
+        off_t offset) {
+    if (offset >= e->size) {
+        return 0;
+    }
+    if (size > e->size - offset) {
+        size = e->size - offset;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        off_t index = (offset + done) / e->block_size;
+        off_t within = (offset + done) % e->block_size;
+        size_t n = e->block_size - within;
+        if (n > size - done) {
+            n = size - done;
+        }
+
+        output_t *o = get_block(e, index);
+        if (o == NULL) {
+            return done > 0 ? done : -EIO;
+        }
+        int r = output_read(o, cache, buf + done, n, within);
+        output_put(o);
+        if (r < 0) {
+            return done > 0 ? done : r;
+        }
+        /* A command producing less than it was asked for leaves zeroes so that
+         * the file keeps its advertised size.
+         */
+        memset(buf + done + r, 0, n - r);
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,17 @@
+#ifndef _EXECFS_RANGE_H_
+#define _EXECFS_RANGE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "cbuf.h"
+#include "entry.h"
+
+/* Serve a read of an entry in range mode. The read is split into aligned
+ * blocks, each of which is produced by running the entry's command with
+ * EXECFS_OFFSET and EXECFS_LENGTH set and kept in a per-entry cache. Returns
+ * the number of bytes read or a negative errno value.
+ */
+int range_read(entry_t *e, cbuf_cache_t *cache, char *buf, size_t size,
+    off_t offset);
+
+#endif
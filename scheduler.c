@@ -0,0 +1,164 @@
+/* Scheduler thread that re-runs entries' commands at a fixed rate. */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include "entry.h"
+#include "globals.h"
+#include "output.h"
+#include "scheduler.h"
+
+/* Per-entry scheduling state, indexed as the entries array. */
+typedef struct {
+    double base;    /* Unjittered time of the next run. */
+    double due;     /* Jittered time of the next run. */
+    int in_flight;
+} slot_t;
+
+static slot_t *slots = NULL;
+
+/* Protects everything below. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+static int stopping = 0;
+static size_t running = 0;
+static int started = 0;
+static pthread_t thread;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Offset a run by up to refresh_jitter percent of the interval either way so
+ * that entries with the same interval don't all run at once.
+ */
+static double jitter(entry_t *e) {
+    double range = e->refresh * refresh_jitter / 100.0;
+    return range * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+static void *worker(void *arg) {
+    entry_t *e = (entry_t*)arg;
+    slot_t *s = &slots[e - entries];
+
+    (void)output_refresh(e);
+
+    pthread_mutex_lock(&lock);
+    /* Keep a fixed rate by scheduling from the previous run's nominal time,
+     * unless we have fallen a whole interval behind.
+     */
+    double t = now();
+    s->base += e->refresh;
+    if (s->base < t) {
+        s->base = t;
+    }
+    s->due = s->base + jitter(e);
+    s->in_flight = 0;
+    --running;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void *scheduler(void *arg) {
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        double t = now();
+        double next = -1;
+
+        size_t i;
+        for (i = 0; i < entries_sz; ++i) {
+            slot_t *s = &slots[i];
+            if (entries[i].refresh <= 0 || s->in_flight) {
+                continue;
+            }
+            if (s->due <= t && (refresh_concurrency == 0 ||
+                    running < refresh_concurrency)) {
+                pthread_t w;
+                if (pthread_create(&w, NULL, worker, &entries[i]) == 0) {
+                    pthread_detach(w);
+                    s->in_flight = 1;
+                    ++running;
+                    continue;
+                }
+            }
+            if (next < 0 || s->due < next) {
+                next = s->due;
+            }
+        }
+
+        if (next < 0 || next <= t) {
+            /* Either nothing is waiting or what is due is waiting for a free
+             * worker. Both change only when a worker finishes.
+             */
+            pthread_cond_wait(&wake, &lock);
+        } else {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            double d = next - t;
+            ts.tv_sec += (time_t)d;
+            ts.tv_nsec += (long)((d - (time_t)d) * 1e9);
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&wake, &lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int scheduler_start(void) {
+    size_t i;
+    int needed = 0;
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i].refresh > 0) {
+            needed = 1;
+            break;
+        }
+    }
+    if (!needed) {
+        return 0;
+    }
+
+    slots = (slot_t*)calloc(entries_sz, sizeof(slot_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    /* Everything runs as soon as possible so there is output to serve. */
+    double t = now();
+    for (i = 0; i < entries_sz; ++i) {
+        slots[i].base = slots[i].due = t;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    srand(time(NULL));
+    if (pthread_create(&thread, NULL, scheduler, NULL) != 0) {
+        return -1;
+    }
+    started = 1;
+    return 0;
+}
+
+void scheduler_stop(void) {
+    if (!started) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    started = 0;
+}
+
+int scheduler_running(void) {
+    return started;
+}
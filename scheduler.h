@@ -0,0 +1,14 @@
+#ifndef _EXECFS_SCHEDULER_H_
+#define _EXECFS_SCHEDULER_H_
+
+/* Periodic refresh of entries with a refresh interval. The scheduler must be
+ * started after FUSE has daemonised, so it is started from the init callback.
+ * Returns non-zero on failure.
+ */
+int scheduler_start(void);
+void scheduler_stop(void);
+
+/* Returns non-zero if the scheduler has been started and not stopped. */
+int scheduler_running(void);
+
+#endif
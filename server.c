@@ -0,0 +1,326 @@
+/* Persistent worker processes for entries in server mode. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "admission.h"
+#include "entry.h"
+#include "globals.h"
+#include "output.h"
+#include "pipes.h"
+#include "server.h"
+#include "stats.h"
+
+/* A request waiting for its reply. */
+typedef struct request {
+    unsigned long id;
+    int done;
+    int err;          /* Negative errno value if the request failed. */
+    output_t *output; /* Reply on success. */
+    struct request *next;
+} request_t;
+
+/* A running worker. Workers are replaced rather than reused once they exit,
+ * so the reader thread can safely free a dead one.
+ */
+typedef struct worker {
+    int read_fd;
+    int write_fd;
+    pid_t pid;
+    int dead;
+
+    pthread_mutex_t write_lock; /* Serialises whole requests on write_fd. */
+    request_t *pending;         /* Protected by the server lock. */
+    int refs;                   /* Protected by the server lock. */
+} worker_t;
+
+typedef struct server {
+    worker_t *worker; /* Current worker, if any. */
+    unsigned long next_id;
+} server_t;
+
+/* How long workers are given to exit at unmount before being sent SIGTERM,
+ * and then SIGKILL.
+ */
+#define STOP_TIMEOUT_MS 2000
+
+/* Protects every entry's server state and the pending lists of workers. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled when any request completes. */
+static pthread_cond_t replied = PTHREAD_COND_INITIALIZER;
+
+/* Drop a reference to a worker. Called with the lock held. */
+static void worker_put(worker_t *w) {
+    if (--w->refs == 0) {
+        close(w->read_fd);
+        if (w->write_fd != -1) {
+            close(w->write_fd);
+        }
+        if (w->pid != -1) {
+            pipe_release(w->pid);
+        }
+        pthread_mutex_destroy(&w->write_lock);
+        free(w);
+    }
+}
+
+/* Read exactly len bytes from a worker. Returns non-zero on EOF or error. */
+static int read_all(worker_t *w, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sz = read(w->read_fd, buf, len);
+        if (sz < 0 && errno == EINTR) {
+            continue;
+        } else if (sz <= 0) {
+            return -1;
+        }
+        buf += sz;
+        len -= sz;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sz = write(fd, buf, len);
+        if (sz < 0 && errno == EINTR) {
+            continue;
+        } else if (sz < 0) {
+            return -1;
+        }
+        buf += sz;
+        len -= sz;
+    }
+    return 0;
+}
+
+/* Read a reply header line. Returns non-zero on EOF, error or malformed input.
+ * Headers are short, so reading a byte at a time keeps payloads out of any
+ * buffer of ours.
+ */
+static int read_header(worker_t *w, unsigned long *id, int *status,
+        size_t *len) {
+    char line[128];
+    size_t i = 0;
+    for (;;) {
+        if (i == sizeof(line) - 1 || read_all(w, &line[i], 1) != 0) {
+            return -1;
+        }
+        if (line[i] == '\n') {
+            break;
+        }
+        ++i;
+    }
+    line[i] = '\0';
+    return sscanf(line, "%lu %d %zu", id, status, len) == 3 ? 0 : -1;
+}
+
+/* Complete a pending request. Called with the lock held. */
+static void complete(worker_t *w, unsigned long id, int err, output_t *o) {
+    request_t **p = &w->pending;
+    while (*p != NULL && (*p)->id != id) {
+        p = &(*p)->next;
+    }
+    if (*p == NULL) {
+        /* A reply to nothing we asked. */
+        if (o != NULL) {
+            output_put(o);
+        }
+        return;
+    }
+    request_t *r = *p;
+    *p = r->next;
+    r->done = 1;
+    r->err = err;
+    r->output = o;
+    pthread_cond_broadcast(&replied);
+}
+
+static void *reader(void *arg) {
+    worker_t *w = (worker_t*)arg;
+
+    for (;;) {
+        unsigned long id;
+        int status;
+        size_t len;
+        if (read_header(w, &id, &status, &len) != 0) {
+            break;
+        }
+        char *data = (char*)malloc(len == 0 ? 1 : len);
+        if (data == NULL || read_all(w, data, len) != 0) {
+            free(data);
+            break;
+        }
+
+        output_t *o = NULL;
+        if (status == 0) {
+            o = output_new(data, len);
+        } else {
+            free(data);
+        }
+
+        pthread_mutex_lock(&lock);
+        complete(w, id, o == NULL ? -EIO : 0, o);
+        pthread_mutex_unlock(&lock);
+    }
+
+    /* The worker has gone away or is talking nonsense. Fail everything still
+     * waiting and let the next request start a new worker.
+     */
+    pthread_mutex_lock(&lock);
+    w->dead = 1;
+    while (w->pending != NULL) {
+        complete(w, w->pending->id, -EIO, NULL);
+    }
+    STATS_INC(server_worker_exits);
+    worker_put(w);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* Get a reference to an entry's live worker, starting one if necessary. Called
+ * with the lock held.
+ */
+static worker_t *get_worker(entry_t *e) {
+    if (e->server == NULL) {
+        e->server = (server_t*)calloc(1, sizeof(server_t));
+        if (e->server == NULL) {
+            return NULL;
+        }
+    }
+    server_t *s = e->server;
+
+    if (s->worker != NULL && s->worker->dead) {
+        worker_put(s->worker);
+        s->worker = NULL;
+    }
+
+    if (s->worker == NULL) {
+        worker_t *w = (worker_t*)calloc(1, sizeof(worker_t));
+        if (w == NULL) {
+            return NULL;
+        }
+        if (pipe_open(e->command, "rw", &e->spawn, NULL, &w->read_fd,
+                &w->write_fd, &w->pid) != 0) {
+            free(w);
+            return NULL;
+        }
+        pthread_mutex_init(&w->write_lock, NULL);
+        /* One reference for the entry and one for the reader thread. */
+        w->refs = 2;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, reader, w) != 0) {
+            w->refs = 1;
+            worker_put(w);
+            return NULL;
+        }
+        pthread_detach(thread);
+        s->worker = w;
+        STATS_INC(server_worker_starts);
+    }
+
+    ++s->worker->refs;
+    return s->worker;
+}
+
+int server_request(entry_t *e, uid_t uid, const char *input, size_t len,
+        output_t **out) {
+    int err = admission_enter(e, ADMIT_INTERNAL, 0);
+    if (err != 0) {
+        return err;
+    }
+
+    pthread_mutex_lock(&lock);
+    worker_t *w = get_worker(e);
+    if (w == NULL) {
+        pthread_mutex_unlock(&lock);
+        admission_leave(e);
+        return -EIO;
+    }
+    request_t r = {
+        .id = e->server->next_id++,
+        .done = 0,
+        .err = 0,
+        .output = NULL,
+        .next = w->pending,
+    };
+    w->pending = &r;
+    pthread_mutex_unlock(&lock);
+
+    char header[128];
+    int header_len = snprintf(header, sizeof(header), "%lu %u %zu ", r.id,
+        (unsigned int)uid, len);
+    pthread_mutex_lock(&w->write_lock);
+    int failed = write_all(w->write_fd, header, header_len) != 0 ||
+        write_all(w->write_fd, e->path, strlen(e->path)) != 0 ||
+        write_all(w->write_fd, "\n", 1) != 0 ||
+        (len > 0 && write_all(w->write_fd, input, len) != 0);
+    pthread_mutex_unlock(&w->write_lock);
+
+    pthread_mutex_lock(&lock);
+    if (failed && !r.done) {
+        complete(w, r.id, -EIO, NULL);
+    }
+    while (!r.done) {
+        pthread_cond_wait(&replied, &lock);
+    }
+    worker_put(w);
+    pthread_mutex_unlock(&lock);
+
+    admission_leave(e);
+    STATS_INC(server_requests);
+    if (r.err != 0) {
+        return r.err;
+    }
+    *out = r.output;
+    return 0;
+}
+
+void server_stop(void) {
+    /* Every worker is told to exit before any is waited for, so that they
+     * shut down together.
+     */
+    pid_t *pids = (pid_t*)malloc(sizeof(pid_t) * (entries_sz + 1));
+    size_t pids_sz = 0;
+
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        server_t *s = entries[i].server;
+        if (s == NULL || s->worker == NULL) {
+            continue;
+        }
+        worker_t *w = s->worker;
+        s->worker = NULL;
+
+        /* Closing its stdin tells the worker to exit. It is reaped here
+         * rather than left to the reaper, which is about to go away.
+         */
+        pid_t pid = w->pid;
+        pthread_mutex_lock(&w->write_lock);
+        close(w->write_fd);
+        w->write_fd = -1;
+        pthread_mutex_unlock(&w->write_lock);
+        w->pid = -1;
+        worker_put(w);
+
+        if (pids != NULL) {
+            pids[pids_sz++] = pid;
+        } else {
+            pthread_mutex_unlock(&lock);
+            pipe_stop(pid, STOP_TIMEOUT_MS);
+            pthread_mutex_lock(&lock);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < pids_sz; ++i) {
+        pipe_stop(pids[i], STOP_TIMEOUT_MS);
+    }
+    free(pids);
+}
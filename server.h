@@ -0,0 +1,35 @@
+#ifndef _EXECFS_SERVER_H_
+#define _EXECFS_SERVER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "entry.h"
+#include "output.h"
+
+/* Server mode, where an entry's command is a long-running worker that
+ * answers one framed request per open. Requests are written to the worker's
+ * stdin as
+ *
+ *     <id> <uid> <length> <path>\n<length bytes of input>
+ *
+ * and the worker replies on its stdout, in any order, with
+ *
+ *     <id> <status> <length>\n<length bytes of output>
+ *
+ * where a non-zero status fails the request. The worker is started on the
+ * first request and restarted on the next request if it exits.
+ */
+
+/* Send a request to an entry's worker and wait for the reply. On success,
+ * returns 0 and the reply's output in *out. Otherwise returns a negative errno
+ * value.
+ */
+int server_request(entry_t *e, uid_t uid, const char *input, size_t len,
+    output_t **out);
+
+/* Stop every entry's worker by closing its stdin and wait for it to exit,
+ * terminating any that take too long.
+ */
+void server_stop(void);
+
+#endif
@@ -0,0 +1,161 @@
+/* Appending writes to shared destination files. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "entry.h"
+#include "globals.h"
+#include "sink.h"
+#include "stats.h"
+#include "writer.h"
+
+struct sink {
+    char *path;
+    int fd;
+    writer_t *writer;
+    int sync_interval;
+    struct sink *next;
+};
+
+/* Protects the list of destinations and the sinks of every entry. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sink *destinations = NULL;
+
+/* Find or open a destination. Called with the lock held. */
+static struct sink *destination(const char *path, size_t limit,
+        int sync_interval) {
+    struct sink *s;
+    for (s = destinations; s != NULL; s = s->next) {
+        if (!strcmp(s->path, path)) {
+            break;
+        }
+    }
+
+    if (s == NULL) {
+        s = (struct sink*)malloc(sizeof(struct sink));
+        if (s == NULL) {
+            return NULL;
+        }
+        s->path = strdup(path);
+        if (s->path == NULL) {
+            goto destination_fail1;
+        }
+        s->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (s->fd == -1) {
+            goto destination_fail2;
+        }
+        s->writer = writer_new(s->fd, limit);
+        if (s->writer == NULL) {
+            goto destination_fail3;
+        }
+        s->sync_interval = 0;
+        s->next = destinations;
+        destinations = s;
+    }
+
+    /* Entries sharing a destination get the most frequent sync any of them
+     * asked for.
+     */
+    if (sync_interval > 0 &&
+            (s->sync_interval == 0 || sync_interval < s->sync_interval)) {
+        s->sync_interval = sync_interval;
+        writer_sync_every(s->writer, sync_interval);
+    }
+    return s;
+
+destination_fail3:
+    close(s->fd);
+destination_fail2:
+    free(s->path);
+destination_fail1:
+    free(s);
+    return NULL;
+}
+
+int sink_open(entry_t *e) {
+    pthread_mutex_lock(&lock);
+    if (e->sinks != NULL) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    struct sink **sinks = (struct sink**)malloc(sizeof(struct sink*) *
+        e->sink_paths_sz);
+    if (sinks == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -ENOMEM;
+    }
+    size_t limit = e->write_buffer > 0 ? e->write_buffer : write_buffer_size;
+    size_t i;
+    for (i = 0; i < e->sink_paths_sz; ++i) {
+        /* Destinations opened before a failure are left for other opens. */
+        errno = 0;
+        sinks[i] = destination(e->sink_paths[i], limit, e->fdatasync);
+        if (sinks[i] == NULL) {
+            int err = errno == 0 ? EIO : errno;
+            pthread_mutex_unlock(&lock);
+            free(sinks);
+            return -err;
+        }
+    }
+    e->sinks = sinks;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int sink_write(entry_t *e, const char *buf, size_t size) {
+    /* Fail before queueing anything rather than leave the data on only some
+     * of the destinations. Once it has been queued anywhere, a failure on a
+     * later destination is left for the next flush to report.
+     */
+    size_t i;
+    for (i = 0; i < e->sink_paths_sz; ++i) {
+        int r = writer_error(e->sinks[i]->writer);
+        if (r < 0) {
+            return r;
+        }
+    }
+    for (i = 0; i < e->sink_paths_sz; ++i) {
+        int r = writer_write(e->sinks[i]->writer, buf, size);
+        if (r < 0 && i == 0) {
+            return r;
+        }
+    }
+    STATS_INC(sink_writes);
+    STATS_ADD(sink_bytes, size);
+    return size;
+}
+
+int sink_flush(entry_t *e) {
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < e->sink_paths_sz; ++i) {
+        int r = writer_flush(e->sinks[i]->writer);
+        if (r != 0 && ret == 0) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+void sink_stop(void) {
+    pthread_mutex_lock(&lock);
+    while (destinations != NULL) {
+        struct sink *s = destinations;
+        destinations = s->next;
+        (void)writer_close(s->writer);
+        close(s->fd);
+        free(s->path);
+        free(s);
+    }
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        free(entries[i].sinks);
+        entries[i].sinks = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+}
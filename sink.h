@@ -0,0 +1,33 @@
+#ifndef _EXECFS_SINK_H_
+#define _EXECFS_SINK_H_
+
+#include <stddef.h>
+#include "entry.h"
+
+/* Sink entries, which append whatever is written to them to one or more
+ * files without running a command. Each destination file is opened once and
+ * shared, along with its writer thread, by every sink entry naming it, so
+ * concurrent appenders are batched into as few writes as possible.
+ */
+
+/* Open the destinations of a sink entry if they are not open already.
+ * Returns 0 or a negative errno value.
+ */
+int sink_open(entry_t *e);
+
+/* Queue data to be appended to each of an entry's destinations. Data from one
+ * call is never interleaved with data from another. Returns the number of
+ * bytes accepted or a negative errno value, in which case none of the
+ * destinations has been given the data.
+ */
+int sink_write(entry_t *e, const char *buf, size_t size);
+
+/* Wait until data queued for an entry's destinations before the call has
+ * been written. Returns 0 or a negative errno value.
+ */
+int sink_flush(entry_t *e);
+
+/* Write out and close every destination. */
+void sink_stop(void);
+
+#endif
@@ -0,0 +1,28 @@
+/* Runtime statistics, presented to the user via the --stats file. */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "stats.h"
+
+stats_t stats;
+
+char *stats_render(size_t *len) {
+    char *buf = NULL;
+    size_t sz = 0;
+    FILE *f = open_memstream(&buf, &sz);
+    if (f == NULL) {
+        return NULL;
+    }
+
+#define FIELD(field) fprintf(f, "%s %llu\n", #field, stats.field);
+    STATS_FIELDS(FIELD)
+#undef FIELD
+
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *len = sz;
+    return buf;
+}
@@ -0,0 +1,62 @@
+#ifndef _EXECFS_STATS_H_
+#define _EXECFS_STATS_H_
+
+#include <stddef.h>
+
+/* Runtime statistics. Each is a counter or gauge updated atomically from
+ * whichever thread observes the event. The list is kept as an X-macro so the
+ * rendering in stats.c never falls out of step with the structure.
+ */
+#define STATS_FIELDS(X) \
+    X(children_running) \
+    X(opens_admitted) \
+    X(opens_queued) \
+    X(opens_waiting) \
+    X(opens_rejected) \
+    X(queue_wait_us_total) \
+    X(queue_wait_us_max) \
+    X(refresh_runs) \
+    X(refresh_failures) \
+    X(compressed_bytes_in) \
+    X(compressed_bytes_out) \
+    X(range_blocks_run) \
+    X(range_blocks_hit) \
+    X(server_requests) \
+    X(server_worker_starts) \
+    X(server_worker_exits) \
+    X(input_fetches) \
+    X(input_bytes) \
+    X(writer_batches) \
+    X(writer_syncs) \
+    X(sink_writes) \
+    X(sink_bytes) \
+    X(log_dropped) \
+    X(builtin_opens)
+
+typedef struct {
+#define FIELD(field) unsigned long long field;
+    STATS_FIELDS(FIELD)
+#undef FIELD
+} stats_t;
+
+extern stats_t stats;
+
+#define STATS_ADD(field, n) ((void)__sync_fetch_and_add(&stats.field, (n)))
+#define STATS_SUB(field, n) ((void)__sync_fetch_and_sub(&stats.field, (n)))
+#define STATS_INC(field) STATS_ADD(field, 1)
+#define STATS_DEC(field) STATS_SUB(field, 1)
+#define STATS_MAX(field, n) \
+    do { \
+        unsigned long long _old = stats.field; \
+        while ((n) > _old && \
+               !__sync_bool_compare_and_swap(&stats.field, _old, (n))) { \
+            _old = stats.field; \
+        } \
+    } while (0)
+
+/* Render the current statistics as "name value" lines into a newly allocated
+ * buffer. Returns NULL on failure.
+ */
+char *stats_render(size_t *len);
+
+#endif
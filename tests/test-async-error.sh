@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Test that a failure writing buffered data to a command that has exited is
+# reported to the writer, at the latest when the file is closed.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+head -c 1000000 /dev/zero >"$1/file" 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "Writing to an exited command succeeded." >&2
+    exit 1
+fi
+
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Test that asynchronous writes reach the command intact and in order, even
+# when there is much more data than the write buffer holds.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+EXPECTED=`mktemp`
+seq 1 100000 >"${EXPECTED}"
+
+cat "${EXPECTED}" >"$1/file"
+if [ $? -ne 0 ]; then
+    echo "Failed to write to file." >&2
+    rm -f "${EXPECTED}"
+    exit 1
+fi
+sleep 0.1
+cmp -s "${EXPECTED}" /tmp/_execfs_test-async-write.testing
+RESULT=$?
+rm -f "${EXPECTED}" /tmp/_execfs_test-async-write.testing
+if [ ${RESULT} -ne 0 ]; then
+    echo "Incorrect data received by command." >&2
+    exit 1
+fi
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Test that background runs queued behind --max-children are never refused,
+# however many are waiting, and don't use up the opens' queue.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+OUT=`mktemp -d`
+cat "$1/slow" >/dev/null &
+RUNNING=$!
+sleep 0.2
+for i in `seq 10`; do
+    cat "$1/swr$i" >"${OUT}/$i" &
+done
+wait
+
+for i in `seq 10`; do
+    if [ "`cat "${OUT}/$i"`" != "$i" ]; then
+        echo "Background run $i was refused." >&2
+        rm -rf "${OUT}"
+        exit 1
+    fi
+done
+rm -rf "${OUT}"
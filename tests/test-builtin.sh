@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Test that content, file and template entries are served by execfs itself.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+TEMPLATE=/tmp/_execfs_test-builtin.tmpl
+trap 'rm -f "${TEMPLATE}"' EXIT
+
+if [ "`cat "$1/content"`" != "`printf 'one\ttwo\nthree\\\\n'`" ]; then
+    echo "Content was not unescaped." >&2
+    exit 1
+elif [ `stat -c %s "$1/content"` -ne 15 ]; then
+    echo "Content has the wrong size." >&2
+    exit 1
+fi
+
+if ! cmp -s /etc/passwd "$1/file"; then
+    echo "File differs from the original." >&2
+    exit 1
+fi
+
+# Templates are read afresh on every open.
+echo 'Hello ${USER}, ${EXECFS_TEST_UNSET}!' >"${TEMPLATE}"
+if [ "`cat "$1/template"`" != "Hello ${USER}, !" ]; then
+    echo "Template was not expanded." >&2
+    exit 1
+fi
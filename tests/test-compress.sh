@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Test that compressed cached output reads back the same as the command's,
+# both from the start and from the middle of the file. The command writes its
+# output in one go so that it is all there for the first read.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+if ! cmp -s <(seq 1 10000) "$1/file"; then
+    echo "Compressed output differs from the command's." >&2
+    exit 1
+fi
+
+EXPECTED=`seq 1 10000 | tail -c +30001 | head -c 5000`
+ACTUAL=`dd if="$1/file" bs=1 skip=30000 count=5000 status=none`
+if [ "${EXPECTED}" != "${ACTUAL}" ]; then
+    echo "Read from the middle of compressed output differs." >&2
+    exit 1
+fi
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Test that inputs are fed to the command in order, and that an input the
+# opener can't read can't be read through another entry either.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+JOINED=`cat "$1/joined" | tr '\n' ' '`
+if [ "${JOINED}" != "1 3 2 4 " ]; then
+    echo "Joined inputs gave ${JOINED}." >&2
+    exit 1
+fi
+
+if cat "$1/leak" >/dev/null 2>&1; then
+    echo "An unreadable input was read through another entry." >&2
+    exit 1
+fi
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Test that an open is rejected with EAGAIN when --max-queue opens are already
+# waiting, while the running and queued opens succeed.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+cat "$1/slow" >/dev/null &
+RUNNING=$!
+sleep 0.2
+cat "$1/slow" >/dev/null &
+QUEUED=$!
+sleep 0.2
+ERROR="`cat "$1/slow" 2>&1 >/dev/null`"
+REJECTED_STATUS=$?
+wait ${RUNNING}
+RUNNING_STATUS=$?
+wait ${QUEUED}
+QUEUED_STATUS=$?
+
+if [ ${RUNNING_STATUS} -ne 0 -o ${QUEUED_STATUS} -ne 0 ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ ${REJECTED_STATUS} -eq 0 ]; then
+    echo "Open past the queue limit succeeded." >&2
+    exit 1
+elif [[ "${ERROR}" != *"Resource temporarily unavailable"* ]]; then
+    echo "Open past the queue limit failed with the wrong error: ${ERROR}" >&2
+    exit 1
+fi
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Test that opens past an entry's max_concurrent wait their turn rather than
+# failing or running at once.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+# Each reader makes a single read. The second open is admitted as soon as the
+# first command exits, and a further read through the first one racing with it
+# can have the kernel take the file to be empty for both.
+START=`date +%s%N`
+dd bs=4096 count=1 if="$1/slow" of=/tmp/_execfs_test-queue.1 2>/dev/null &
+FIRST=$!
+dd bs=4096 count=1 if="$1/slow" of=/tmp/_execfs_test-queue.2 2>/dev/null &
+SECOND=$!
+wait ${FIRST}
+FIRST_STATUS=$?
+wait ${SECOND}
+SECOND_STATUS=$?
+ELAPSED=$(( (`date +%s%N` - START) / 1000000 ))
+
+OUTPUT="`cat /tmp/_execfs_test-queue.1 /tmp/_execfs_test-queue.2`"
+rm -f /tmp/_execfs_test-queue.1 /tmp/_execfs_test-queue.2
+if [ ${FIRST_STATUS} -ne 0 -o ${SECOND_STATUS} -ne 0 ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ "${OUTPUT}" != "done
+done" ]; then
+    echo "Incorrect output received." >&2
+    exit 1
+elif [ ${ELAPSED} -lt 2000 ]; then
+    echo "Commands ran concurrently (${ELAPSED}ms)." >&2
+    exit 1
+fi
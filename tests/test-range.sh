@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Test that range mode produces each block of the file by running the command
+# for that block alone.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+SIZE=`cat "$1/file" | wc -c`
+if [ "${SIZE}" -ne 16384 ]; then
+    echo "Read ${SIZE} bytes rather than the whole file." >&2
+    exit 1
+fi
+
+for OFFSET in 0 4096 8192 12288; do
+    LINE=`dd if="$1/file" bs=4096 skip=$((OFFSET / 4096)) count=1 status=none | head -n 1`
+    if [ "${LINE}" != "${OFFSET}" ]; then
+        echo "Block at ${OFFSET} starts with ${LINE}." >&2
+        exit 1
+    fi
+done
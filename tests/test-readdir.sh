@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Test that every entry is listed with the inode number stat reports for it
+# and that no two entries share one.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+LISTED=`ls -i "$1" | awk '{ print $2 "=" $1 }' | sort | tr '\n' ' '`
+STATED=`cd "$1" && stat -c '%n=%i' one two | sort | tr '\n' ' '`
+if [ "${LISTED}" != "${STATED}" ]; then
+    echo "Listed inodes ${LISTED}differ from ${STATED}." >&2
+    exit 1
+fi
+
+if [ `stat -c %i "$1/one"` == `stat -c %i "$1/two"` ]; then
+    echo "Entries share an inode." >&2
+    exit 1
+fi
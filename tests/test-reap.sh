@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Test that the slot of a command that outlives its open is handed back as
+# soon as the command exits, rather than when next polled for.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+START=`date +%s%N`
+for i in `seq 20`; do
+    if [ "`cat "$1/lingering"`" != "done" ]; then
+        echo "Failed to read from file." >&2
+        exit 1
+    fi
+done
+ELAPSED_MS=$(( (`date +%s%N` - START) / 1000000 ))
+
+if [ ${ELAPSED_MS} -ge 1200 ]; then
+    echo "20 opens with one slot took ${ELAPSED_MS}ms." >&2
+    exit 1
+fi
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Test that refresh replaces the output in the background without anyone
+# reading the file, and that an entry whose run failed returns an error
+# immediately rather than waiting for the next run.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+FIRST=`cat "$1/file"`
+SECOND=`cat "$1/file"`
+if [ -z "${FIRST}" ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ "${FIRST}" != "${SECOND}" ]; then
+    echo "Output changed without a refresh." >&2
+    exit 1
+fi
+
+sleep 2.5
+NEW=`cat "$1/file"`
+if [ -z "${NEW}" -o "${NEW}" == "${FIRST}" ]; then
+    echo "Output was not refreshed." >&2
+    exit 1
+fi
+
+START=`date +%s%N`
+for i in 1 2; do
+    if cat "$1/failing" >/dev/null 2>&1; then
+        echo "Read from an entry without output succeeded." >&2
+        exit 1
+    fi
+done
+ELAPSED=$(( (`date +%s%N` - START) / 1000000 ))
+if [ ${ELAPSED} -ge 5000 ]; then
+    echo "Reads from an entry without output waited ${ELAPSED}ms." >&2
+    exit 1
+fi
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Test that server mode answers every open from the same running worker, which
+# replies with its process ID.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+FIRST=`cat "$1/file"`
+SECOND=`cat "$1/file"`
+if [ -z "${FIRST}" ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ "${FIRST}" != "${SECOND}" ]; then
+    echo "Requests were answered by different workers." >&2
+    exit 1
+elif ! kill -0 "${FIRST}" 2>/dev/null; then
+    echo "The worker is not running." >&2
+    exit 1
+fi
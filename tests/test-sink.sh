@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Test that sinks append writes to every destination, including one shared by
+# several entries, and that a failing destination fails writes to it.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+SHARED=/tmp/_execfs_test-sink.testing
+BOTH=/tmp/_execfs_test-sink-both.testing
+trap 'rm -f "${SHARED}" "${BOTH}"' EXIT
+
+if ! echo one >"$1/one" || ! echo both >"$1/both"; then
+    echo "Failed to write to sink." >&2
+    exit 1
+fi
+if [ "`cat "${SHARED}" | tr '\n' ' '`" != "one both " ]; then
+    echo "Shared destination has the wrong contents." >&2
+    exit 1
+elif [ "`cat "${BOTH}"`" != "both" ]; then
+    echo "Second destination has the wrong contents." >&2
+    exit 1
+fi
+
+# The error is reported when the file is closed, which cat checks and the
+# shell's own redirection doesn't.
+for i in 1 2; do
+    if echo full | cat >"$1/full" 2>/dev/null; then
+        echo "Write to a full destination succeeded." >&2
+        exit 1
+    fi
+done
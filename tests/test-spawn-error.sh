@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Test that a command whose settings can't be applied fails the open with the
+# error met, rather than leaving an empty file, while one whose settings can
+# be applied runs.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+if [ "`cat "$1/runnable"`" != "ran" ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+fi
+
+ERROR="`cat "$1/unrunnable" 2>&1`"
+if [ $? -eq 0 ]; then
+    echo "Open of a command that couldn't be set up succeeded." >&2
+    exit 1
+elif [[ "${ERROR}" != *"Invalid argument"* ]]; then
+    echo "Open failed with the wrong error: ${ERROR}" >&2
+    exit 1
+fi
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Test that a failed stale_while_revalidate run isn't retried by every open
+# before its interval has passed.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+rm -f /tmp/_execfs_test-swr-backoff.runs
+for i in `seq 5`; do
+    if cat "$1/failing" >/dev/null 2>&1; then
+        echo "Open of a failed entry succeeded." >&2
+        rm -f /tmp/_execfs_test-swr-backoff.runs
+        exit 1
+    fi
+done
+
+RUNS=`wc -l </tmp/_execfs_test-swr-backoff.runs`
+rm -f /tmp/_execfs_test-swr-backoff.runs
+if [ ${RUNS} -ne 1 ]; then
+    echo "The command was run ${RUNS} times." >&2
+    exit 1
+fi
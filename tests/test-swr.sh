@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Test that stale_while_revalidate serves the same output while it is fresh,
+# serves it once more after it expires and then moves on to a new one.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+FIRST=`cat "$1/file"`
+SECOND=`cat "$1/file"`
+if [ -z "${FIRST}" ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ "${FIRST}" != "${SECOND}" ]; then
+    echo "Fresh output was not reused." >&2
+    exit 1
+fi
+
+sleep 2.5
+STALE=`cat "$1/file"`
+if [ "${STALE}" != "${FIRST}" ]; then
+    echo "Expired output was not served while revalidating." >&2
+    exit 1
+fi
+
+sleep 0.5
+NEW=`cat "$1/file"`
+if [ -z "${NEW}" -o "${NEW}" == "${FIRST}" ]; then
+    echo "Output was not revalidated." >&2
+    exit 1
+fi
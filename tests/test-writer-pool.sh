@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Test that asynchronously written files sharing a single writer thread all
+# have their data delivered intact, rather than waiting on each other.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+EXPECTED=`mktemp`
+seq 1 100000 >"${EXPECTED}"
+rm -f /tmp/_execfs_test-writer-pool.*
+
+for i in `seq 10`; do
+    cat "${EXPECTED}" >"$1/file" &
+done
+wait
+sleep 0.1
+
+COUNT=0
+RESULT=0
+for f in /tmp/_execfs_test-writer-pool.*; do
+    COUNT=$((COUNT + 1))
+    cmp -s "${EXPECTED}" "$f" || RESULT=1
+done
+rm -f "${EXPECTED}" /tmp/_execfs_test-writer-pool.*
+if [ ${COUNT} -ne 10 -o ${RESULT} -ne 0 ]; then
+    echo "Incorrect data received by commands." >&2
+    exit 1
+fi
@@ -8,8 +8,14 @@ if [ $# -ne 2 ]; then
     exit 1
 fi
 
+# Any further arguments a test needs are kept next to its configuration.
+ARGS="${2%.config}.args"
+if [ -f "${ARGS}" ]; then
+    EXTRA_ARGS=`cat "${ARGS}"`
+fi
+
 MOUNT=`mktemp -d`
-execfs --config "$2" --fuse "${MOUNT}" && \
+execfs --config "$2" ${EXTRA_ARGS} --fuse "${MOUNT}" && \
  "$1" "${MOUNT}" && \
  fusermount -uz "${MOUNT}" && \
  rm -rf "${MOUNT}"
@@ -0,0 +1,356 @@
+/* This program replays a trace of file operations, as recorded by execfs's
+ * --trace option, against the file system library in-process. There is no
+ * FUSE or kernel round trip, so the trace runs as fast as the library can
+ * serve it and the timings reported are those of execfs itself.
+ *
+ * A trace has one operation per line:
+ *
+ *   getattr PATH
+ *   readdir OFFSET PATH
+ *   open HANDLE FLAGS PATH
+ *   read HANDLE SIZE OFFSET
+ *   write HANDLE SIZE OFFSET
+ *   flush HANDLE
+ *   release HANDLE
+ *
+ * where HANDLE is any hex token naming an open file from its open to its
+ * release and FLAGS are the octal open(2) flags. The contents of writes are
+ * not recorded, so replayed writes are of filler bytes.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../execfs.h"
+
+typedef enum {
+    OP_GETATTR,
+    OP_READDIR,
+    OP_OPEN,
+    OP_READ,
+    OP_WRITE,
+    OP_FLUSH,
+    OP_RELEASE,
+    OP_KINDS,
+} kind_t;
+
+static const char *kind_names[OP_KINDS] = {
+    [OP_GETATTR] = "getattr",
+    [OP_READDIR] = "readdir",
+    [OP_OPEN] = "open",
+    [OP_READ] = "read",
+    [OP_WRITE] = "write",
+    [OP_FLUSH] = "flush",
+    [OP_RELEASE] = "release",
+};
+
+typedef struct {
+    kind_t kind;
+    /* Index of the open file operated on, for handle operations. */
+    int slot;
+    int flags;
+    size_t size;
+    off_t offset;
+    char *path;
+} op_t;
+
+static op_t *ops;
+static size_t ops_sz;
+
+/* Open files in the trace are mapped to slots, reusing slots once released,
+ * so replay only needs as many handles as the trace had open at once.
+ */
+static int slots_sz;
+static int *free_slots;
+static int free_slots_sz;
+
+#define BUCKETS 4096
+typedef struct binding {
+    unsigned long long token;
+    int slot;
+    struct binding *next;
+} binding_t;
+static binding_t *bindings[BUCKETS];
+
+static int bind(unsigned long long token) {
+    binding_t *b = (binding_t*)malloc(sizeof(*b));
+    if (b == NULL) {
+        return -1;
+    }
+    if (free_slots_sz > 0) {
+        b->slot = free_slots[--free_slots_sz];
+    } else {
+        int *f = (int*)realloc(free_slots, sizeof(int) * (slots_sz + 1));
+        if (f == NULL) {
+            free(b);
+            return -1;
+        }
+        free_slots = f;
+        b->slot = slots_sz++;
+    }
+    b->token = token;
+    b->next = bindings[token % BUCKETS];
+    bindings[token % BUCKETS] = b;
+    return b->slot;
+}
+
+/* Find the slot of an open token, optionally unbinding it. Returns -1 if the
+ * token isn't open.
+ */
+static int find(unsigned long long token, int unbind) {
+    binding_t **p;
+    for (p = &bindings[token % BUCKETS]; *p != NULL; p = &(*p)->next) {
+        if ((*p)->token == token) {
+            binding_t *b = *p;
+            int slot = b->slot;
+            if (unbind) {
+                *p = b->next;
+                free(b);
+                free_slots[free_slots_sz++] = slot;
+            }
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static op_t *add_op(void) {
+    if ((ops_sz & (ops_sz - 1)) == 0) {
+        op_t *o = (op_t*)realloc(ops, sizeof(op_t) * (ops_sz == 0 ? 1 : ops_sz * 2));
+        if (o == NULL) {
+            return NULL;
+        }
+        ops = o;
+    }
+    op_t *o = &ops[ops_sz++];
+    memset(o, 0, sizeof(*o));
+    return o;
+}
+
+/* Read the trace into memory so parsing isn't part of what is timed.
+ * Operations on handles opened before the trace began are skipped. Returns 0
+ * on success.
+ */
+static int load_trace(const char *filename, size_t *max_size) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("Failed to open trace");
+        return -1;
+    }
+    char line[4096 + 64];
+    char name[16];
+    unsigned long long token;
+    unsigned long long n;
+    long long offset;
+    int pos;
+    size_t lineno = 0;
+    size_t skipped = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        ++lineno;
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%15s", name) != 1) {
+            goto bad;
+        }
+        op_t *o = add_op();
+        if (o == NULL) {
+            goto fail;
+        }
+        if (!strcmp(name, "getattr") &&
+                sscanf(line, "getattr %n", &pos) == 0) {
+            o->kind = OP_GETATTR;
+            o->path = strdup(line + pos);
+        } else if (!strcmp(name, "readdir") &&
+                sscanf(line, "readdir %lld %n", &offset, &pos) == 1) {
+            o->kind = OP_READDIR;
+            o->offset = offset;
+            o->path = strdup(line + pos);
+        } else if (!strcmp(name, "open") &&
+                sscanf(line, "open %llx %o %n", &token, &o->flags, &pos) == 2) {
+            o->kind = OP_OPEN;
+            o->path = strdup(line + pos);
+            /* In case the recording missed a release of this token. */
+            (void)find(token, 1);
+            o->slot = bind(token);
+            if (o->slot == -1) {
+                goto fail;
+            }
+        } else if ((!strcmp(name, "read") || !strcmp(name, "write")) &&
+                sscanf(line, "%*s %llx %llu %lld", &token, &n, &offset) == 3) {
+            o->kind = name[0] == 'r' ? OP_READ : OP_WRITE;
+            o->size = n;
+            o->offset = offset;
+            if (o->size > *max_size) {
+                *max_size = o->size;
+            }
+            o->slot = find(token, 0);
+        } else if ((!strcmp(name, "flush") || !strcmp(name, "release")) &&
+                sscanf(line, "%*s %llx", &token) == 1) {
+            o->kind = name[0] == 'f' ? OP_FLUSH : OP_RELEASE;
+            o->slot = find(token, o->kind == OP_RELEASE);
+        } else {
+            goto bad;
+        }
+        if ((o->kind == OP_GETATTR || o->kind == OP_READDIR ||
+                o->kind == OP_OPEN) && o->path == NULL) {
+            goto fail;
+        }
+        if (o->kind != OP_GETATTR && o->kind != OP_READDIR && o->slot == -1) {
+            --ops_sz;
+            ++skipped;
+        }
+    }
+    fclose(f);
+    if (skipped > 0) {
+        fprintf(stderr, "Skipped %zu operations on files opened before the "
+            "trace began\n", skipped);
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%zu: unrecognised operation: %s\n", filename, lineno,
+        line);
+    fclose(f);
+    return -1;
+fail:
+    perror("Failed to load trace");
+    fclose(f);
+    return -1;
+}
+
+static int count_entry(void *buf, const char *name, const struct stat *stbuf,
+        off_t offset) {
+    ++*(size_t*)buf;
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s config trace [repeat]\n", argv[0]);
+        return -1;
+    }
+    unsigned long repeat = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+    if (repeat == 0) {
+        fprintf(stderr, "Repeat must be positive\n");
+        return -1;
+    }
+
+    size_t max_size = 0;
+    if (load_trace(argv[2], &max_size) != 0) {
+        return -1;
+    }
+    char *buf = (char*)malloc(max_size == 0 ? 1 : max_size);
+    uint64_t *fhs = (uint64_t*)calloc(slots_sz + 1, sizeof(uint64_t));
+    char *live = (char*)calloc(slots_sz + 1, 1);
+    if (buf == NULL || fhs == NULL || live == NULL) {
+        perror("Failed to allocate");
+        return -1;
+    }
+    memset(buf, 'x', max_size);
+
+    /* As FUSE would. */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (execfs_load(argv[1], NULL) != 0) {
+        return -1;
+    }
+    (void)execfs_start();
+
+    unsigned long long count[OP_KINDS] = { 0 };
+    unsigned long long errors[OP_KINDS] = { 0 };
+    double elapsed[OP_KINDS] = { 0 };
+    unsigned long long bytes = 0;
+
+    double start = now();
+    unsigned long r;
+    for (r = 0; r < repeat; ++r) {
+        size_t i;
+        for (i = 0; i < ops_sz; ++i) {
+            op_t *o = &ops[i];
+            struct stat st;
+            size_t entries = 0;
+            int ret;
+            double t = now();
+            switch (o->kind) {
+                case OP_GETATTR:
+                    ret = execfs_getattr(o->path, &st);
+                    break;
+                case OP_READDIR:
+                    ret = execfs_readdir(o->path, &entries, count_entry,
+                        o->offset);
+                    break;
+                case OP_OPEN:
+                    ret = execfs_open(o->path, o->flags, getuid(), getgid(),
+                        &fhs[o->slot]);
+                    live[o->slot] = ret == 0;
+                    break;
+                case OP_READ:
+                    ret = live[o->slot] ?
+                        execfs_read(fhs[o->slot], buf, o->size, o->offset) :
+                        -EBADF;
+                    break;
+                case OP_WRITE:
+                    ret = live[o->slot] ?
+                        execfs_write(fhs[o->slot], buf, o->size, o->offset) :
+                        -EBADF;
+                    break;
+                case OP_FLUSH:
+                    ret = live[o->slot] ? execfs_flush(fhs[o->slot]) : -EBADF;
+                    break;
+                case OP_RELEASE:
+                    ret = live[o->slot] ? execfs_release(fhs[o->slot]) : -EBADF;
+                    live[o->slot] = 0;
+                    break;
+                default:
+                    ret = -EINVAL;
+            }
+            elapsed[o->kind] += now() - t;
+            ++count[o->kind];
+            if (ret < 0) {
+                ++errors[o->kind];
+            } else if (o->kind == OP_READ || o->kind == OP_WRITE) {
+                bytes += ret;
+            }
+        }
+
+        /* Close anything the trace left open so each pass starts afresh. */
+        int s;
+        for (s = 0; s < slots_sz; ++s) {
+            if (live[s]) {
+                (void)execfs_release(fhs[s]);
+                live[s] = 0;
+            }
+        }
+    }
+    double total = now() - start;
+
+    execfs_stop();
+
+    unsigned long long all = 0;
+    printf("%-8s %12s %10s %12s\n", "op", "count", "errors", "mean us");
+    int k;
+    for (k = 0; k < OP_KINDS; ++k) {
+        if (count[k] == 0) {
+            continue;
+        }
+        printf("%-8s %12llu %10llu %12.2f\n", kind_names[k], count[k],
+            errors[k], elapsed[k] / count[k] * 1e6);
+        all += count[k];
+    }
+    printf("%llu operations, %llu bytes in %.3fs: %.0f ops/s\n", all, bytes,
+        total, all / total);
+    return 0;
+}
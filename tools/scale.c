@@ -0,0 +1,187 @@
+/* This program measures how the file system's throughput scales with the
+ * number of threads operating on it, as FUSE's worker threads would. It links
+ * against the library and drives it in-process. For each thread count it
+ * runs two workloads for a fixed time:
+ *
+ *   shared: every thread reads 4KB at random offsets through a single open
+ *           handle, as readers sharing a descriptor would.
+ *   opens:  every thread repeatedly opens the file, reads it to the end and
+ *           releases it.
+ *
+ * The shared workload needs a file whose output is kept for the handle, such
+ * as an entry with cache, stale_while_revalidate or content set.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../execfs.h"
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_SECONDS 2
+#define READ_SIZE 4096
+
+static const char *path;
+static uint64_t shared_fh;
+static size_t shared_len;
+static int stop;
+
+typedef struct {
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long long ops;
+    int error;
+} worker_t;
+
+static void *shared_reader(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    char buf[READ_SIZE];
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        off_t offset = rand_r(&w->seed) % shared_len;
+        int r = execfs_read(shared_fh, buf, sizeof(buf), offset);
+        if (r < 0) {
+            w->error = r;
+            break;
+        }
+        ++w->ops;
+    }
+    return NULL;
+}
+
+static void *opener(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    char buf[READ_SIZE * 16];
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        uint64_t fh;
+        int r = execfs_open(path, O_RDONLY, getuid(), getgid(), &fh);
+        if (r != 0) {
+            w->error = r;
+            break;
+        }
+        off_t offset = 0;
+        while ((r = execfs_read(fh, buf, sizeof(buf), offset)) > 0) {
+            offset += r;
+        }
+        (void)execfs_release(fh);
+        if (r < 0) {
+            w->error = r;
+            break;
+        }
+        ++w->ops;
+    }
+    return NULL;
+}
+
+/* Run a workload on the given number of threads for some seconds and return
+ * the operations completed per second, or a negative value on failure.
+ */
+static double run(void *(*workload)(void*), int threads, unsigned int seconds) {
+    worker_t *workers = (worker_t*)calloc(threads, sizeof(worker_t));
+    if (workers == NULL) {
+        return -1;
+    }
+    __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int i;
+    for (i = 0; i < threads; ++i) {
+        workers[i].seed = i + 1;
+        if (pthread_create(&workers[i].thread, NULL, workload,
+                &workers[i]) != 0) {
+            break;
+        }
+    }
+    int started = i;
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    unsigned long long ops = 0;
+    int error = started == threads ? 0 : -EAGAIN;
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        if (workers[i].error != 0) {
+            error = workers[i].error;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(workers);
+
+    if (error != 0) {
+        fprintf(stderr, "Failed with %d threads: %s\n", threads,
+            strerror(-error));
+        return -1;
+    }
+    return ops / (end.tv_sec - start.tv_sec +
+        (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "Usage: %s config path [threads [seconds]]\n",
+            argv[0]);
+        return -1;
+    }
+    path = argv[2];
+    int max_threads = argc > 3 ? atoi(argv[3]) : DEFAULT_THREADS;
+    int seconds = argc > 4 ? atoi(argv[4]) : DEFAULT_SECONDS;
+    if (max_threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "Threads and seconds must be positive\n");
+        return -1;
+    }
+
+    /* As FUSE would. */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (execfs_load(argv[1], NULL) != 0) {
+        return -1;
+    }
+    (void)execfs_start();
+
+    /* Read the whole file once through the shared handle so that its length
+     * is known and any cache is filled.
+     */
+    int r = execfs_open(path, O_RDONLY, getuid(), getgid(), &shared_fh);
+    if (r != 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(-r));
+        return -1;
+    }
+    char buf[READ_SIZE];
+    while ((r = execfs_read(shared_fh, buf, sizeof(buf), shared_len)) > 0) {
+        shared_len += r;
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(-r));
+        return -1;
+    }
+
+    printf("%-8s %16s %16s\n", "threads", "shared reads/s", "opens/s");
+    int threads;
+    for (threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        double shared = shared_len > 0 ?
+            run(shared_reader, threads, seconds) : 0;
+        double opens = run(opener, threads, seconds);
+        if (shared < 0 || opens < 0) {
+            return -1;
+        }
+        printf("%-8d %16.0f %16.0f\n", threads, shared, opens);
+        fflush(stdout);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    (void)execfs_release(shared_fh);
+    execfs_stop();
+    return 0;
+}
@@ -0,0 +1,435 @@
+/* Asynchronous write pipeline used for entries with async_write enabled and
+ * for sink destinations.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "globals.h"
+#include "stats.h"
+#include "writer.h"
+
+struct writer {
+    int fd;
+    size_t limit;
+
+    pthread_mutex_t lock;
+    pthread_cond_t drained; /* Signalled when a batch has been written. */
+
+    /* Data waiting to be written. */
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    /* Spare buffer a pool thread swaps with buf to write a batch without
+     * holding the lock.
+     */
+    char *spare;
+    size_t spare_cap;
+
+    /* Bytes ever accepted and written. Flushes wait for the latter to catch
+     * up with the former as of the flush, so that a descriptor shared by
+     * several busy appenders cannot keep a flush waiting forever.
+     */
+    unsigned long long queued;
+    unsigned long long written;
+
+    /* Periodic fdatasync(), if sync_interval is non-zero. */
+    int sync_interval;
+    int dirty; /* Data has been written since the last sync. */
+    struct timespec next_sync;
+
+    int error;   /* First errno since a flush last reported one. Data is
+                  * discarded until then. */
+    int closing;
+    int closed;  /* Drained after closing; the pool is done with it. */
+
+    /* Protected by the pool lock rather than the writer's own. */
+    int scheduled;             /* Queued for, or being served by, the pool. */
+    struct writer *next;       /* In the pool's queue. */
+    int waiting;               /* On the pool's list of pending syncs. */
+    struct timespec sync_at;   /* Copy of next_sync for the pool. */
+    struct writer *next_sync_w;
+};
+
+/* Writers are drained by a shared pool of at most writer_threads threads.
+ * A writer is queued whenever it has data to write or is closing, and is
+ * served by one thread at a time, a batch per turn, so that writers to a busy
+ * descriptor take turns with the rest. Writers with a periodic sync pending
+ * wait on a separate list until it is due. The pool lock may be taken with a
+ * writer's lock held, never the other way round.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond;
+static int pool_ready = 0;
+static writer_t *queue_head = NULL;
+static writer_t *queue_tail = NULL;
+static writer_t *syncs = NULL;
+static size_t threads = 0;
+static size_t idle = 0;
+
+/* Write an entire buffer, retrying on short writes. Returns 0 or an errno. */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sz = write(fd, buf, len);
+        if (sz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        buf += sz;
+        len -= sz;
+    }
+    return 0;
+}
+
+static int due(const struct timespec *at) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > at->tv_sec ||
+           (now.tv_sec == at->tv_sec && now.tv_nsec >= at->tv_nsec);
+}
+
+/* Sync written data to disk. Called and returns with the lock held. */
+static void sync_fd(writer_t *w) {
+    w->dirty = 0;
+    pthread_mutex_unlock(&w->lock);
+    int err = fdatasync(w->fd) != 0 ? errno : 0;
+    STATS_INC(writer_syncs);
+    pthread_mutex_lock(&w->lock);
+    if (err != 0 && w->error == 0) {
+        w->error = err;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &w->next_sync);
+    w->next_sync.tv_sec += w->sync_interval;
+}
+
+static void *pool_thread(void *arg);
+
+/* Queue a writer for the pool unless it already is. Called with the pool
+ * lock held.
+ */
+static void schedule(writer_t *w) {
+    if (w->scheduled) {
+        return;
+    }
+    w->scheduled = 1;
+    w->next = NULL;
+    if (queue_tail == NULL) {
+        queue_head = queue_tail = w;
+    } else {
+        queue_tail->next = w;
+        queue_tail = w;
+    }
+    /* Started on demand rather than at startup because FUSE forks when
+     * daemonising, which would leave the threads behind.
+     */
+    if (idle == 0 && threads < writer_threads) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_thread, NULL) == 0) {
+            pthread_detach(thread);
+            ++threads;
+            return;
+        }
+    }
+    pthread_cond_signal(&pool_cond);
+}
+
+/* Take a writer off the pool's list of pending syncs. Called with the pool
+ * lock held.
+ */
+static void unwait(writer_t *w) {
+    if (!w->waiting) {
+        return;
+    }
+    writer_t **p = &syncs;
+    while (*p != w) {
+        p = &(*p)->next_sync_w;
+    }
+    *p = w->next_sync_w;
+    w->waiting = 0;
+}
+
+/* Give a writer one turn: write a batch, sync if due or finish closing. Called
+ * with the writer's lock held, which is released. Once closed, the writer may
+ * be freed as soon as the lock is.
+ */
+static void serve(writer_t *w) {
+    if (w->len > 0) {
+        /* Take everything queued so far as one batch. */
+        char *batch = w->buf;
+        size_t batch_len = w->len;
+        size_t batch_cap = w->cap;
+        int err = w->error;
+        w->buf = w->spare;
+        w->cap = w->spare_cap;
+        w->len = 0;
+        pthread_mutex_unlock(&w->lock);
+
+        if (err == 0) {
+            err = write_all(w->fd, batch, batch_len);
+        } else {
+            /* Discarded until the error is reported. */
+            err = 0;
+        }
+        STATS_INC(writer_batches);
+
+        pthread_mutex_lock(&w->lock);
+        w->spare = batch;
+        w->spare_cap = batch_cap;
+        w->written += batch_len;
+        w->dirty = 1;
+        if (err != 0 && w->error == 0) {
+            w->error = err;
+        }
+        pthread_cond_broadcast(&w->drained);
+    }
+
+    int sync = w->dirty && w->sync_interval > 0;
+    if (sync && (due(&w->next_sync) || (w->closing && w->len == 0))) {
+        sync_fd(w);
+        sync = 0;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    unwait(w);
+    if (w->len > 0) {
+        /* More arrived meanwhile; go to the back of the queue. */
+        w->scheduled = 0;
+        schedule(w);
+    } else if (w->closing) {
+        w->closed = 1;
+        pthread_mutex_unlock(&pool_lock);
+        pthread_cond_broadcast(&w->drained);
+        pthread_mutex_unlock(&w->lock);
+        return;
+    } else {
+        w->scheduled = 0;
+        if (sync) {
+            w->sync_at = w->next_sync;
+            w->next_sync_w = syncs;
+            syncs = w;
+            w->waiting = 1;
+            pthread_cond_signal(&pool_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Queue the writers whose sync is due and return the earliest deadline of
+ * the rest in at. Returns whether any are left. Called with the pool lock
+ * held.
+ */
+static int schedule_syncs(struct timespec *at) {
+    int pending = 0;
+    writer_t *w = syncs;
+    while (w != NULL) {
+        writer_t *next = w->next_sync_w;
+        if (due(&w->sync_at)) {
+            unwait(w);
+            schedule(w);
+        } else if (!pending || w->sync_at.tv_sec < at->tv_sec ||
+                (w->sync_at.tv_sec == at->tv_sec &&
+                 w->sync_at.tv_nsec < at->tv_nsec)) {
+            *at = w->sync_at;
+            pending = 1;
+        }
+        w = next;
+    }
+    return pending;
+}
+
+static void *pool_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        /* Checked before every turn so that syncs aren't put off by a
+         * constantly busy queue.
+         */
+        struct timespec at;
+        int pending = schedule_syncs(&at);
+        if (queue_head == NULL) {
+            ++idle;
+            if (pending) {
+                (void)pthread_cond_timedwait(&pool_cond, &pool_lock, &at);
+            } else {
+                pthread_cond_wait(&pool_cond, &pool_lock);
+            }
+            --idle;
+            continue;
+        }
+
+        writer_t *w = queue_head;
+        queue_head = w->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        pthread_mutex_lock(&w->lock);
+        serve(w);
+
+        pthread_mutex_lock(&pool_lock);
+    }
+    /* Unreachable. */
+    return NULL;
+}
+
+writer_t *writer_new(int fd, size_t limit) {
+    pthread_mutex_lock(&pool_lock);
+    if (!pool_ready) {
+        /* Pending syncs are waited for with deadlines. */
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        int r = pthread_cond_init(&pool_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        if (r != 0) {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+        pool_ready = 1;
+    }
+    if (threads == 0) {
+        /* Make sure there is always at least one thread to drain writers. */
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_thread, NULL) != 0) {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+        pthread_detach(thread);
+        ++threads;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    writer_t *w = (writer_t*)malloc(sizeof(writer_t));
+    if (w == NULL) {
+        return NULL;
+    }
+    memset(w, 0, sizeof(writer_t));
+    w->fd = fd;
+    w->limit = limit;
+
+    if (pthread_mutex_init(&w->lock, NULL) != 0) {
+        goto writer_new_fail1;
+    }
+    if (pthread_cond_init(&w->drained, NULL) != 0) {
+        goto writer_new_fail2;
+    }
+    return w;
+
+writer_new_fail2:
+    pthread_mutex_destroy(&w->lock);
+writer_new_fail1:
+    free(w);
+    return NULL;
+}
+
+int writer_write(writer_t *w, const char *buf, size_t size) {
+    pthread_mutex_lock(&w->lock);
+
+    /* Apply backpressure. A write larger than the limit is still accepted
+     * once the buffer is empty so that it can make progress.
+     */
+    while (w->error == 0 && w->len > 0 && w->len + size > w->limit) {
+        pthread_cond_wait(&w->drained, &w->lock);
+    }
+    if (w->error != 0) {
+        int err = w->error;
+        pthread_mutex_unlock(&w->lock);
+        return -err;
+    }
+
+    if (w->len + size > w->cap) {
+        size_t cap = w->cap == 0 ? 4096 : w->cap;
+        while (cap < w->len + size) {
+            cap *= 2;
+        }
+        char *b = (char*)realloc(w->buf, cap);
+        if (b == NULL) {
+            /* Make sure the loss is reported by the next flush even if the
+             * caller can't report it.
+             */
+            w->error = ENOMEM;
+            pthread_mutex_unlock(&w->lock);
+            return -ENOMEM;
+        }
+        w->buf = b;
+        w->cap = cap;
+    }
+    memcpy(w->buf + w->len, buf, size);
+    w->len += size;
+    w->queued += size;
+
+    pthread_mutex_lock(&pool_lock);
+    schedule(w);
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&w->lock);
+    return size;
+}
+
+void writer_sync_every(writer_t *w, int interval) {
+    pthread_mutex_lock(&w->lock);
+    w->sync_interval = interval;
+    clock_gettime(CLOCK_MONOTONIC, &w->next_sync);
+    w->next_sync.tv_sec += interval;
+    /* Data already written is synced by the new deadline. */
+    if (w->dirty) {
+        pthread_mutex_lock(&pool_lock);
+        schedule(w);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+int writer_flush(writer_t *w) {
+    pthread_mutex_lock(&w->lock);
+    unsigned long long target = w->queued;
+    while (w->error == 0 && w->written < target) {
+        pthread_cond_wait(&w->drained, &w->lock);
+    }
+    /* An error is reported once, after which the writer starts afresh
+     * rather than failing everyone sharing it from then on.
+     */
+    int err = w->error;
+    w->error = 0;
+    pthread_mutex_unlock(&w->lock);
+    return -err;
+}
+
+int writer_error(writer_t *w) {
+    pthread_mutex_lock(&w->lock);
+    int err = w->error;
+    pthread_mutex_unlock(&w->lock);
+    return -err;
+}
+
+int writer_close(writer_t *w) {
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_mutex_lock(&pool_lock);
+    schedule(w);
+    pthread_mutex_unlock(&pool_lock);
+
+    /* The pool is done with the writer only once everything queued has been
+     * written (or discarded after an error).
+     */
+    while (!w->closed) {
+        pthread_cond_wait(&w->drained, &w->lock);
+    }
+    int err = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_cond_destroy(&w->drained);
+    pthread_mutex_destroy(&w->lock);
+    free(w->buf);
+    free(w->spare);
+    free(w);
+    return -err;
+}
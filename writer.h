@@ -0,0 +1,45 @@
+#ifndef _EXECFS_WRITER_H_
+#define _EXECFS_WRITER_H_
+
+#include <stddef.h>
+
+/* Asynchronous, coalescing writer to a file descriptor. Data handed to a
+ * writer is appended to an in-memory buffer and one of a pool of threads
+ * shared by every writer (see --writer-threads) drains it to the descriptor in
+ * as few write() calls as possible. Callers block only when the amount of
+ * pending data exceeds the writer's limit.
+ */
+typedef struct writer writer_t;
+
+/* Create a writer draining to fd, buffering at most limit bytes. The
+ * descriptor remains owned by the caller. Returns NULL on failure.
+ */
+writer_t *writer_new(int fd, size_t limit);
+
+/* Additionally fdatasync() the descriptor every interval seconds while data
+ * is being written, and once more when the writer is closed.
+ */
+void writer_sync_every(writer_t *w, int interval);
+
+/* Queue data for writing. Data from each call is written contiguously, even
+ * when several threads share a writer. Returns the number of bytes accepted
+ * or a negative errno value if a write to the descriptor has failed since the
+ * last flush.
+ */
+int writer_write(writer_t *w, const char *buf, size_t size);
+
+/* Wait until all data queued before the call has been written. Returns 0 on
+ * success or a negative errno value if any write failed since the last flush,
+ * in which case the error is cleared and later data is written again.
+ */
+int writer_flush(writer_t *w);
+
+/* Return the error the next flush would report, without clearing it, or 0. */
+int writer_error(writer_t *w);
+
+/* Flush, wait for the pool to finish with the writer and free it. Returns as
+ * writer_flush().
+ */
+int writer_close(writer_t *w);
+
+#endif